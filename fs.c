@@ -27,7 +27,9 @@ FILE *init_log_file(){
 void write_log(const char *format, ...){
     va_list ap;
     va_start(ap, format);
-    vfprintf(NEWFS_PRIVATE_DATA->logfile, format, ap);
+    //The low-level API has no FUSE context, write to the file opened by init_log_file.
+    vfprintf(logfile, format, ap);
+    va_end(ap);
 }
 
 void error_handler(int rc){
@@ -94,9 +96,13 @@ void init_store(){
     }
 }
 
-//Read the root object from the store.
+//Read the root object from the store. A root object written before fields were added to it is shorter,
+//the missing fields are cleared. The fetched length is kept in a local variable, so the root object is
+//always written whole.
 int read_root(){
-	return unqlite_kv_fetch(pDb,ROOT_OBJECT_KEY,ROOT_OBJECT_KEY_SIZE,&root_object,ROOT_OBJECT_SIZE_P);
+	unqlite_int64 size = sizeof(struct rootS);
+	memset(&root_object,0,sizeof(struct rootS));
+	return unqlite_kv_fetch(pDb,ROOT_OBJECT_KEY,ROOT_OBJECT_KEY_SIZE,&root_object,&size);
 }
 
 //Write the root object to the store.
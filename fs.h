@@ -23,6 +23,8 @@ extern unqlite_int64 root_object_size_value;
 
 typedef struct rootS{
 	uuid_t id;
+	long long blocks; // number of data blocks in use
+	long long files; // number of files and directories
 }*root;
 
 extern unqlite *pDb;
@@ -6,9 +6,11 @@
 
 #define FUSE_USE_VERSION 26
 
-#include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <stddef.h>
 
 #include "myfs.h"
 
@@ -18,1013 +20,3443 @@
  */
 static struct my_open_file open_files[MY_MAX_OPEN_FILES];
 
-// Get file and directory attributes (meta-data).
-// Read 'man 2 stat' and 'man 2 chmod'.
-static int myfs_getattr(const char *path, struct stat *stbuf){
-  write_log("myfs_getattr(path=\"%s\", statbuf=0x%08x)\n", path, stbuf);
+/**
+ * @var Number of allocated write buffers in the open file table
+ * Used to limit the memory used by the buffers and to skip looking for them
+ */
+static int num_write_buffers = 0;
 
-  struct my_fcb file_fcb;
+/**
+ * @var Block cache
+ * Shared by all files, data blocks are looked up by their UUIDs
+ */
+struct my_cache block_cache;
 
-  // try to find the file by its path and current user
-  int result = find_file(path, get_context_user(), &file_fcb);
+/**
+ * @var Number of times data blocks were written or removed
+ * Protected by block_cache_lock. A block read from the database is cached only
+ * if the number did not change during the read, otherwise the data could be
+ * out of date.
+ */
+static unsigned long block_changes = 0;
 
-  if (result == MYFS_FIND_NO_ACCESS) {
-    // user cannot access one of the parent directories
-    write_log("myfs_getattr - EACCES\n");
-    return -EACCES;
+/**
+ * @var Read ahead queue
+ * Filled by sequential reads, emptied by the read ahead thread
+ */
+struct my_readahead_queue readahead_queue = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .changed = PTHREAD_COND_INITIALIZER,
+};
 
-  } else if (result != MYFS_FIND_FOUND) {
-    // file does not exist
-    write_log("myfs_getattr - ENOENT\n");
-    return -ENOENT;
-  }
+/**
+ * @var FCB cache
+ * Shared by all files, FCBs of open files are kept in it while they are open
+ */
+struct my_cache fcb_cache;
 
-  // clear the stat struct
-  memset(stbuf, 0, sizeof(struct stat));
+/**
+ * @var Dentry cache
+ * Shared by all directories, names are looked up together with the directory UUID
+ */
+struct my_cache dentry_cache;
 
-  // copy values from the FCB into the stat struct
-  stbuf->st_mode = file_fcb.mode;
-  stbuf->st_nlink = file_fcb.nlink;
-  stbuf->st_uid = file_fcb.uid;
-  stbuf->st_gid = file_fcb.gid;
-  stbuf->st_size = file_fcb.size;
-  stbuf->st_atime = file_fcb.atime;
-  stbuf->st_mtime = file_fcb.mtime;
-  stbuf->st_ctime = file_fcb.ctime;
+/**
+ * @var Inode table
+ * Inode numbers the kernel uses to identify files, mapped to their FCB UUIDs
+ */
+struct my_inode_table inode_table;
 
-  return 0;
+/**
+ * @var Group commit
+ * Counts the operations changing the database, protected by its own mutex
+ */
+struct my_group_commit group_commit;
+
+/**
+ * @var Directory containing the database, used to find out the free space
+ * Opened by init_fs, because the working directory changes when the process
+ * becomes a daemon. -1 if it is not open.
+ */
+static int store_dir = -1;
+
+/**
+ * @var Boolean, set when the usage counters in the root object are not written yet
+ * Protected by db_lock together with the root object
+ */
+static char usage_changed = 0;
+
+/**
+ * @var Pinned FCB of the root directory
+ * Every path lookup starts with it, the UUID is null until it is pinned
+ */
+static struct my_fcb root_fcb;
+
+/**
+ * @var Locks of the shared in-memory structures and the database handle
+ * All of them are recursive, so functions holding one can call other
+ * functions which take it again. They are initialised on first use.
+ */
+static pthread_mutex_t block_cache_lock;
+static pthread_mutex_t fcb_cache_lock;
+static pthread_mutex_t dentry_cache_lock;
+static pthread_mutex_t inode_table_lock;
+static pthread_mutex_t open_files_lock;
+static pthread_mutex_t fcb_locks_lock;
+static pthread_mutex_t db_lock;
+static pthread_once_t locks_once = PTHREAD_ONCE_INIT;
+
+/**
+ * @var Reader/writer locks of the FCBs currently in use
+ * Hash table by FCB UUID, protected by fcb_locks_lock
+ */
+static struct my_fcb_lock* fcb_locks[MY_FCB_LOCK_BUCKETS];
+
+/**
+ * @var Mount options
+ * Default values are replaced by values from the command line, e.g. -o cache_blocks=1024
+ */
+static struct my_options options = {
+  .cache_blocks = MY_DEFAULT_CACHE_BLOCKS,
+  .cache_fcbs = MY_DEFAULT_CACHE_FCBS,
+  .cache_dentries = MY_DEFAULT_CACHE_DENTRIES,
+  .readahead_blocks = MY_DEFAULT_READAHEAD_BLOCKS,
+  .commit_ops = MY_DEFAULT_COMMIT_OPS,
+  .commit_interval = MY_DEFAULT_COMMIT_INTERVAL,
+};
+
+/**
+ * @brief Reads the user and group IDs of the process which made the request
+ * @param req FUSE request
+ * @return User struct with user and group IDs
+ */
+static struct my_user get_request_user(fuse_req_t req) {
+  // copy UID and GID from the request context into the user struct
+  const struct fuse_ctx* context = fuse_req_ctx(req);
+
+  struct my_user user = {
+    .uid = context->uid,
+    .gid = context->gid,
+  };
+
+  return user;
 }
 
-// Read a directory.
-// Read 'man 2 readdir'.
-static int myfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi){
-  write_log("write_readdir(path=\"%s\", buf=0x%08x, filler=0x%08x, offset=%lld, fi=0x%08x)\n", path, buf, filler, offset, fi);
+/**
+ * @brief Writes data buffered in open handles of a file to the database
+ *
+ * The write lock of the file is only taken if there is some buffered data, so
+ * that readers of files without buffered writes do not block each other.
+ *
+ * @param id UUID of the FCB of the file
+ */
+static void flush_locked_file_buffers(uuid_t id) {
+  if (has_file_buffers(id)) {
+    lock_fcb(id, 1);
+    flush_file_buffers(id);
+    unlock_fcb(id);
+  }
+}
 
-  // get the FCB of the directory by the file handle returned by opendir
-  struct my_fcb dir_fcb;
-  get_open_file(fi->fh, &dir_fcb);
+/**
+ * @brief Reads the FCB of the file the kernel knows by an inode number
+ * @param ino Inode number
+ * @param file_fcb Pointer to a FCB where the file will be stored
+ * @return 0 on success, -1 if the inode is not used or the file was deleted
+ */
+static int read_inode_file(fuse_ino_t ino, struct my_fcb* file_fcb) {
+  uuid_t id;
+
+  if (!get_inode_id(ino, id)) {
+    return -1;
+  }
 
-  filler(buf, ".", NULL, 0);
-  filler(buf, "..", NULL, 0);
+  // buffered data changes the size of the file
+  flush_locked_file_buffers(id);
 
-  // iterate directory entries
-  struct my_dir_iter iter;
-  iterate_dir_entries(&dir_fcb, &iter);
+  return (read_file(&id, file_fcb) == 0) ? 0 : -1;
+}
 
-  struct my_dir_entry* entry;
+/**
+ * @brief Locks the FCB of the file the kernel knows by an inode number
+ * @param ino Inode number
+ * @param write 1 for an exclusive lock, 0 for a shared one
+ * @param id UUID of the locked FCB
+ * @return 1 on success, 0 if the inode is not used
+ */
+static char lock_inode(fuse_ino_t ino, char write, uuid_t id) {
+  if (!get_inode_id(ino, id)) {
+    return 0;
+  }
+
+  lock_fcb(id, write);
+  return 1;
+}
+
+/**
+ * @brief Locks the FCB of the file the kernel knows by an inode number and reads it
+ * @param ino Inode number
+ * @param write 1 for an exclusive lock, 0 for a shared one
+ * @param file_fcb Pointer to a FCB where the file will be stored
+ * @return 0 on success, -1 if the inode is not used or the file was deleted,
+ *         the FCB is not locked then
+ */
+static int lock_inode_file(fuse_ino_t ino, char write, struct my_fcb* file_fcb) {
+  uuid_t id;
 
-  while ((entry = next_dir_entry(&iter)) != NULL) {
-    filler(buf, entry->name, NULL, 0);
+  if (!lock_inode(ino, write, id)) {
+    return -1;
   }
 
-  clean_dir_iterator(&iter);
+  // the file could have been deleted before it was locked
+  if (read_file(&id, file_fcb) != 0) {
+    unlock_fcb(id);
+    return -1;
+  }
 
   return 0;
 }
 
-// Read a file.
-// Read 'man 2 read'.
-static int myfs_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi){
-  write_log("myfs_read(path=\"%s\", buf=0x%08x, size=%d, offset=%lld, fi=0x%08x)\n", path, buf, size, offset, fi);
+/**
+ * @brief Locks a file found in a locked directory and reads it again
+ *
+ * The FCB found in the directory may have been changed by a thread which held
+ * its lock, so it is read again once it is locked.
+ *
+ * @param file_fcb Pointer to the FCB of the file
+ */
+static void lock_child_file(struct my_fcb* file_fcb) {
+  lock_fcb(file_fcb->id, 1);
+  read_file(&(file_fcb->id), file_fcb);
+}
 
-  // get the FCB of the file by the file handle returned by open
-  struct my_fcb file_fcb;
-  get_open_file(fi->fh, &file_fcb);
+/**
+ * @brief Copies the attributes of a file into a stat struct
+ * @param file_fcb Pointer to the FCB of the file
+ * @param ino Inode number of the file
+ * @param stbuf Pointer to the stat struct
+ */
+static void get_file_stat(struct my_fcb* file_fcb, fuse_ino_t ino, struct stat* stbuf) {
+  // clear the stat struct
+  memset(stbuf, 0, sizeof(struct stat));
 
-  if (file_fcb.size == 0) {
-    // file is empty, nothing to see here
-    return 0;
+  // copy values from the FCB into the stat struct
+  stbuf->st_ino = ino;
+  stbuf->st_mode = file_fcb->mode;
+  stbuf->st_nlink = file_fcb->nlink;
+  stbuf->st_uid = file_fcb->uid;
+  stbuf->st_gid = file_fcb->gid;
+  stbuf->st_size = file_fcb->size;
+  stbuf->st_atime = file_fcb->atime;
+  stbuf->st_mtime = file_fcb->mtime;
+  stbuf->st_ctime = file_fcb->ctime;
+}
 
-  } else if (offset >= file_fcb.size) {
-    // cannot read beyond the end of the file
-    return 0;
+/**
+ * @brief Counts a lookup of a file and fills in the entry returned to the kernel
+ * @param file_fcb Pointer to the FCB of the file
+ * @param entry Pointer to the entry
+ */
+static void get_file_entry(struct my_fcb* file_fcb, struct fuse_entry_param* entry) {
+  memset(entry, 0, sizeof(struct fuse_entry_param));
 
-  } else if ((offset + size) > file_fcb.size) {
-    // cannot read beyond the end of file, but can read until it
-    size = file_fcb.size - offset;
+  entry->ino = add_inode_lookup(file_fcb->id);
+  entry->generation = get_inode_generation(entry->ino);
+  entry->attr_timeout = MY_ATTR_TIMEOUT;
+  entry->entry_timeout = MY_ATTR_TIMEOUT;
 
-    read_file_data(&file_fcb, buf, size, offset);
-    return size;
+  get_file_stat(file_fcb, entry->ino, &(entry->attr));
+}
 
-  } else {
-    // read range is ok
-    read_file_data(&file_fcb, buf, size, offset);
-    return size;
+/**
+ * @brief Replies to a request with the entry of a file
+ *
+ * If the reply does not get to the kernel, the kernel does not count the lookup
+ * either and it is forgotten straight away.
+ *
+ * @param req FUSE request
+ * @param file_fcb Pointer to the FCB of the file
+ */
+static void reply_file_entry(fuse_req_t req, struct my_fcb* file_fcb) {
+  struct fuse_entry_param entry;
+  get_file_entry(file_fcb, &entry);
+
+  if (fuse_reply_entry(req, &entry) != 0) {
+    forget_inode(entry.ino, 1);
   }
 }
 
-// Create a file.
-// Read 'man 2 creat'.
-static int myfs_create(const char *path, mode_t mode, struct fuse_file_info *fi){
-  write_log("myfs_create(path=\"%s\", mode=0%03o, fi=0x%08x)\n", path, mode, fi);
+// Look up a directory entry by name and get its attributes.
+// The kernel remembers the inode number until it is forgotten.
+static void myfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name){
+  write_log("myfs_lookup(parent=%lu, name=\"%s\")\n", parent, name);
 
-  /** @var Parent directory FCB */
   struct my_fcb dir_fcb;
-  /** @var Created file FCB */
   struct my_fcb file_fcb;
 
-  // try to find the file (to check if it exists) and parent directory (to add to)
-  int result = find_dir_entry(path, get_context_user(), &dir_fcb, &file_fcb);
+  if (lock_inode_file(parent, 0, &dir_fcb) < 0) {
+    // parent directory does not exist anymore
+    write_log("myfs_lookup - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+
+  // try to find the file in the directory, lookups in one directory do not
+  // block each other
+  int result = find_dir_child(&dir_fcb, name, get_request_user(req), &file_fcb);
+  unlock_fcb(dir_fcb.id);
 
   if (result == MYFS_FIND_NO_DIR) {
-    // parent directory does not exist
-    write_log("myfs_create - ENOENT\n");
-    return -ENOENT;
+    // parent is not a directory
+    write_log("myfs_lookup - ENOTDIR\n");
+    fuse_reply_err(req, ENOTDIR);
+    return;
 
-  } else if (result == MYFS_FIND_FOUND) {
-    // file already exists
-    write_log("myfs_create - EEXIST\n");
-    return -EEXIST;
+  } else if (result == MYFS_FIND_NO_ACCESS) {
+    // user cannot access the parent directory
+    write_log("myfs_lookup - EACCES\n");
+    fuse_reply_err(req, EACCES);
+    return;
 
-  } else if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !can_write(&dir_fcb, get_context_user())
-  ) {
-    // user cannot access ancestor directory, or cannot write to parent directory
-    write_log("myfs_create - EACCES\n");
-    return -EACCES;
+  } else if (result != MYFS_FIND_FOUND) {
+    // file does not exist
+    write_log("myfs_lookup - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
 
-  } else {
-    // file does not exist and user has sufficient rights
-
-    // create a new file and write it to the database, save FCB to file_fcb
-    create_file(mode, get_context_user(), &file_fcb);
-
-    // get the file name from the path and add the file to the parent directory
-    // path string needs to be duplicated because it will be modified by path_file_name
-    char* path_dup = strdup(path);
-    char* file_name = path_file_name(path_dup);
-    int result = link_file(&dir_fcb, &file_fcb, file_name);
-    free(path_dup);
-
-    if (result < 0) {
-      // the parent directory does not have space left to add the file
-      remove_file(&file_fcb);
-      write_log("myfs_create - EFBIG\n");
-      return -EFBIG;
-    }
+  // the size has to include data still buffered in open file handles
+  if (has_file_buffers(file_fcb.id)) {
+    flush_locked_file_buffers(file_fcb.id);
+    read_file(&(file_fcb.id), &file_fcb);
+  }
 
-    // add the file to open file table and get its file handle
-    int fh = add_open_file(&file_fcb);
+  reply_file_entry(req, &file_fcb);
+}
 
-    if (fh < 0) {
-      // too many files are open
-      write_log("myfs_create - ENFILE\n");
-      return -ENFILE;
-    }
+// Forget about an inode, called when the kernel drops it from its caches.
+static void myfs_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup){
+  write_log("myfs_forget(ino=%lu, nlookup=%lu)\n", ino, nlookup);
 
-    // save the file handle for future calls
-    fi->fh = fh;
+  // the inode number is freed when all lookups are forgotten
+  forget_inode(ino, nlookup);
 
-    return 0;
-  }
+  fuse_reply_none(req);
 }
 
-// Set update the times (actime, modtime) for a file.
-// Read 'man 2 utime'.
-static int myfs_utime(const char *path, struct utimbuf *ubuf){
-  write_log("myfs_utime(path=\"%s\", ubuf=0x%08x)\n", path, ubuf);
+// Get file and directory attributes (meta-data).
+// Read 'man 2 stat' and 'man 2 chmod'.
+static void myfs_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  write_log("myfs_getattr(ino=%lu, fi=0x%08x)\n", ino, fi);
 
   struct my_fcb file_fcb;
 
-  // try to find the file by its path and current user
-  int result = find_file(path, get_context_user(), &file_fcb);
+  if (read_inode_file(ino, &file_fcb) < 0) {
+    // file does not exist
+    write_log("myfs_getattr - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
 
-  if (
-    result == MYFS_FIND_NO_DIR ||
-    result == MYFS_FIND_NO_FILE
-  ) {
+  struct stat stbuf;
+  get_file_stat(&file_fcb, ino, &stbuf);
+
+  fuse_reply_attr(req, &stbuf, MY_ATTR_TIMEOUT);
+}
+
+// Set file attributes, replaces chmod, chown, truncate and utime.
+// Read 'man 2 chmod', 'man 2 chown', 'man 2 truncate' and 'man 2 utime'.
+static void myfs_setattr(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi){
+  write_log("myfs_setattr(ino=%lu, attr=0x%08x, to_set=%d, fi=0x%08x)\n", ino, attr, to_set, fi);
+
+  struct my_user user = get_request_user(req);
+  struct my_fcb file_fcb;
+
+  if (lock_inode_file(ino, 1, &file_fcb) < 0) {
     // file does not exist
-    write_log("myfs_utime - ENOENT\n");
-    return -ENOENT;
+    write_log("myfs_setattr - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+
+  } else if ((to_set & FUSE_SET_ATTR_MODE) && file_fcb.uid != user.uid) {
+    // the current user is not the owner of the file
+    unlock_fcb(file_fcb.id);
+    write_log("myfs_setattr - EPERM\n");
+    fuse_reply_err(req, EPERM);
+    return;
+
+  } else if ((to_set & FUSE_SET_ATTR_SIZE) && !is_file(&file_fcb)) {
+    // only regular files can be truncated
+    unlock_fcb(file_fcb.id);
+    write_log("myfs_setattr - EISDIR\n");
+    fuse_reply_err(req, EISDIR);
+    return;
+
+  } else if ((to_set & FUSE_SET_ATTR_SIZE) && attr->st_size > MY_MAX_FILE_SIZE) {
+    // cannot extend the file beyond the maximum file size
+    unlock_fcb(file_fcb.id);
+    write_log("myfs_setattr - EFBIG\n");
+    fuse_reply_err(req, EFBIG);
+    return;
 
   } else if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !can_write(&file_fcb, get_context_user())
+    (to_set & (FUSE_SET_ATTR_SIZE | FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME)) &&
+    !can_write(&file_fcb, user)
   ) {
-    // user cannot access an ancestor directory or write to the file
-    write_log("myfs_utime - EACCES\n");
-    return -EACCES;
+    // cannot write to the file
+    unlock_fcb(file_fcb.id);
+    write_log("myfs_setattr - EACCES\n");
+    fuse_reply_err(req, EACCES);
+    return;
   }
 
-  // update the FCB
-  file_fcb.atime = ubuf->actime;
-  file_fcb.mtime = ubuf->modtime;
+  if (to_set & FUSE_SET_ATTR_SIZE) {
+    // buffered data has to be written before it is cut off
+    if (flush_file_buffers(file_fcb.id) > 0) {
+      read_file(&(file_fcb.id), &file_fcb);
+    }
+
+    // change the file size, the FCB is written to the database
+    truncate_file(&file_fcb, attr->st_size);
+    mark_file_data_changed(file_fcb.id);
+  }
 
-  // write the updated FCB into the database
-  update_file(&file_fcb);
+  if (to_set & ~FUSE_SET_ATTR_SIZE) {
+    if (to_set & FUSE_SET_ATTR_MODE) file_fcb.mode = attr->st_mode;
+    if (to_set & FUSE_SET_ATTR_UID) file_fcb.uid = attr->st_uid;
+    if (to_set & FUSE_SET_ATTR_GID) file_fcb.gid = attr->st_gid;
+    if (to_set & FUSE_SET_ATTR_ATIME) file_fcb.atime = attr->st_atime;
+    if (to_set & FUSE_SET_ATTR_MTIME) file_fcb.mtime = attr->st_mtime;
 
-  return 0;
+    if (to_set & (FUSE_SET_ATTR_MODE | FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) {
+      file_fcb.ctime = time(0);
+    }
+
+    // write the updated FCB into the database
+    update_file(&file_fcb);
+  }
+
+  unlock_fcb(file_fcb.id);
+
+  struct stat stbuf;
+  get_file_stat(&file_fcb, ino, &stbuf);
+
+  fuse_reply_attr(req, &stbuf, MY_ATTR_TIMEOUT);
 }
 
-// Write to a file.
-// Read 'man 2 write'
-static int myfs_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi){
-  write_log("myfs_write(path=\"%s\", buf=0x%08x, size=%d, offset=%lld, fi=0x%08x)\n", path, buf, size, offset, fi);
+/**
+ * @brief Adds an entry to the buffer returned by readdir
+ * @param req FUSE request
+ * @param buf Buffer for the entries
+ * @param size Size of the buffer
+ * @param used Number of bytes of the buffer already used, updated if the entry fits
+ * @param name Entry name
+ * @param ino Inode number of the entry
+ * @param next Offset where the next readdir call continues after this entry
+ * @return 1 if the entry fits in the buffer, 0 otherwise
+ */
+static char add_readdir_entry(fuse_req_t req, char* buf, size_t size, size_t* used,
+    const char* name, fuse_ino_t ino, off_t next) {
+  struct stat stbuf;
+  memset(&stbuf, 0, sizeof(struct stat));
+  stbuf.st_ino = ino;
 
-  // get the FCB by the file handle
-  struct my_fcb file_fcb;
-  get_open_file(fi->fh, &file_fcb);
+  size_t entry_size = fuse_add_direntry(req, buf + *used, size - *used, name, &stbuf, next);
 
-  if (offset >= MY_MAX_FILE_SIZE) {
-    // cannot writer beyond the maximum file size
-    write_log("myfs_write - EFBIG\n");
-    return -EFBIG;
+  if (entry_size > size - *used) {
+    return 0;
+  }
 
-  } else if ((offset + size) > MY_MAX_FILE_SIZE) {
-    // cannot write beyond the maximum file size, but can write until it
-    size = MY_MAX_FILE_SIZE - offset;
+  *used += entry_size;
+  return 1;
+}
 
-    write_file_data(&file_fcb, (char*)buf, size, offset);
-    return size;
+// Read a directory.
+// Read 'man 2 readdir'.
+static void myfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi){
+  write_log("myfs_readdir(ino=%lu, size=%d, offset=%lld, fi=0x%08x)\n", ino, size, offset, fi);
 
-  } else {
-    // write range is ok
-    write_file_data(&file_fcb, (char*)buf, size, offset);
-    return size;
+  // the directory stays locked while its entries are read
+  struct my_fcb dir_fcb;
+
+  if (lock_inode_file(ino, 0, &dir_fcb) < 0) {
+    write_log("myfs_readdir - EBADF\n");
+    fuse_reply_err(req, EBADF);
+    return;
+  }
+
+  char* buf = malloc(size);
+  size_t used = 0;
+
+  // offsets of the entries are where the next call continues, 1 and 2 are
+  // after the dot entries and then the cookies of the directory entries
+  // entries get an inode number only when they are looked up, until then the
+  // kernel is told it is unknown
+  char full = offset < 1 && !add_readdir_entry(req, buf, size, &used, ".", ino, 1);
+  full = full || (offset < 2 && !add_readdir_entry(req, buf, size, &used, "..", MY_UNKNOWN_INO, 2));
+
+  if (!full) {
+    // iterate directory entries, starting after the last one already returned
+    struct my_dir_iter iter;
+    iterate_dir_entries(&dir_fcb, &iter);
+    seek_dir_iterator(&iter, offset);
+
+    struct my_dir_entry* entry;
+
+    // stop when the buffer is full, the entry is returned again next time
+    while ((entry = next_dir_entry(&iter)) != NULL &&
+        add_readdir_entry(req, buf, size, &used, entry->name, MY_UNKNOWN_INO, iter.cookie));
+
+    clean_dir_iterator(&iter);
   }
+
+  unlock_fcb(dir_fcb.id);
+
+  fuse_reply_buf(req, buf, used);
+  free(buf);
 }
 
-// Set the size of a file.
-// Read 'man 2 truncate'.
-static int myfs_truncate(const char *path, off_t newsize){
-  write_log("myfs_truncate(path=\"%s\", newsize=%lld)\n", path, newsize);
+// Read a file.
+// Read 'man 2 read'.
+static void myfs_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi){
+  write_log("myfs_read(ino=%lu, size=%d, offset=%lld, fi=0x%08x)\n", ino, size, offset, fi);
 
+  uuid_t id;
   struct my_fcb file_fcb;
 
-  // try to find the file by its path
-  int result = find_file(path, get_context_user(), &file_fcb);
+  // data still buffered in open file handles needs to be written first, then
+  // the file is locked shared, so that reads of it do not block each other
+  if (get_inode_id(ino, id)) {
+    flush_locked_file_buffers(id);
+  }
 
-  if (
-    result == MYFS_FIND_NO_DIR ||
-    result == MYFS_FIND_NO_FILE ||
-    !is_file(&file_fcb)
-  ) {
-    // file does not exist, or is not a regular file
-    write_log("myfs_truncate - ENOENT\n");
-    return -ENOENT;
+  if (lock_inode_file(ino, 0, &file_fcb) < 0) {
+    write_log("myfs_read - EBADF\n");
+    fuse_reply_err(req, EBADF);
+    return;
   }
 
-  else if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !can_write(&file_fcb, get_context_user())
-  ) {
-    // cannot access an ancestor directory, or cannot write to the file
-    write_log("myfs_getattr - EACCES\n");
-    return -EACCES;
+  if (file_fcb.size == 0 || offset >= file_fcb.size) {
+    // file is empty or cannot read beyond the end of the file
+    unlock_fcb(file_fcb.id);
+    fuse_reply_buf(req, NULL, 0);
+    return;
+
+  } else if ((offset + (off_t)size) > file_fcb.size) {
+    // cannot read beyond the end of file, but can read until it
+    size = file_fcb.size - offset;
   }
 
-  // change the file size
-  truncate_file(&file_fcb, newsize);
+  char* buf = malloc(size);
+  read_file_data(&file_fcb, buf, size, offset);
 
-  return 0;
+  // sequential reads queue the following blocks for the read ahead thread
+  read_ahead(fi->fh, &file_fcb, size, offset, options.readahead_blocks);
+
+  unlock_fcb(file_fcb.id);
+
+  fuse_reply_buf(req, buf, size);
+  free(buf);
 }
 
-// Set permissions.
-// Read 'man 2 chmod'.
-static int myfs_chmod(const char *path, mode_t mode){
-  write_log("myfs_chmod(fpath=\"%s\", mode=0%03o)\n", path, mode);
+// Create and open a file.
+// Read 'man 2 creat'.
+static void myfs_create(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi){
+  write_log("myfs_create(parent=%lu, name=\"%s\", mode=0%03o, fi=0x%08x)\n", parent, name, mode, fi);
 
-  struct my_user user = get_context_user();
+  struct my_user user = get_request_user(req);
 
-  // try to find the file by its path
+  /** @var Parent directory FCB */
+  struct my_fcb dir_fcb;
+  /** @var Created file FCB */
   struct my_fcb file_fcb;
-  int result = find_file(path, user, &file_fcb);
 
-  if (
-    result == MYFS_FIND_NO_DIR ||
-    result == MYFS_FIND_NO_FILE
-  ) {
-    // file does not exist
-    write_log("myfs_chmod - ENOENT\n");
-    return -ENOENT;
+  // the directory is locked until the file is added to it
+  if (lock_inode_file(parent, 1, &dir_fcb) < 0) {
+    // parent directory does not exist anymore
+    write_log("myfs_create - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
 
-  } else if (result == MYFS_FIND_NO_ACCESS) {
-    // file cannot be accessed
-    write_log("myfs_getattr - EACCES\n");
-    return -EACCES;
+  // try to find the file to check if it exists
+  int result = find_dir_child(&dir_fcb, name, user, &file_fcb);
 
-  } else if (file_fcb.uid != user.uid) {
-    // the current user is not the owner of the file
-    write_log("myfs_getattr - EPERM\n");
-    return -EPERM;
+  if (result == MYFS_FIND_NO_DIR) {
+    // parent is not a directory
+    unlock_fcb(dir_fcb.id);
+    write_log("myfs_create - ENOTDIR\n");
+    fuse_reply_err(req, ENOTDIR);
+    return;
+
+  } else if (result == MYFS_FIND_FOUND) {
+    // file already exists
+    unlock_fcb(dir_fcb.id);
+    write_log("myfs_create - EEXIST\n");
+    fuse_reply_err(req, EEXIST);
+    return;
+
+  } else if (result == MYFS_FIND_NO_ACCESS || !can_write(&dir_fcb, user)) {
+    // user cannot access or write to the parent directory
+    unlock_fcb(dir_fcb.id);
+    write_log("myfs_create - EACCES\n");
+    fuse_reply_err(req, EACCES);
+    return;
   }
 
-  // update the FCB and write it to the database
-  file_fcb.mode = mode;
-  file_fcb.ctime = time(0);
-  update_file(&file_fcb);
+  // create a new file and write it to the database, save FCB to file_fcb
+  create_file(mode, user, &file_fcb);
 
-  return 0;
+  if (link_file(&dir_fcb, &file_fcb, name) < 0) {
+    // the parent directory does not have space left to add the file
+    remove_file(&file_fcb);
+    unlock_fcb(dir_fcb.id);
+    write_log("myfs_create - EFBIG\n");
+    fuse_reply_err(req, EFBIG);
+    return;
+  }
+
+  unlock_fcb(dir_fcb.id);
+
+  // add the file to open file table and get its file handle
+  int fh = add_open_file(&file_fcb);
+
+  if (fh < 0) {
+    // too many files are open
+    write_log("myfs_create - ENFILE\n");
+    fuse_reply_err(req, ENFILE);
+    return;
+  }
+
+  // save the file handle for future calls
+  fi->fh = fh;
+
+  struct fuse_entry_param entry;
+  get_file_entry(&file_fcb, &entry);
+
+  if (fuse_reply_create(req, &entry, fi) != 0) {
+    // the kernel does not know about the file, so it will not release it
+    forget_inode(entry.ino, 1);
+    lock_fcb(file_fcb.id, 1);
+    remove_open_file(fh);
+    unlock_fcb(file_fcb.id);
+  }
 }
 
-// Set ownership.
-// Read 'man 2 chown'.
-static int myfs_chown(const char *path, uid_t uid, gid_t gid){
-  write_log("myfs_chown(path=\"%s\", uid=%d, gid=%d)\n", path, uid, gid);
+// Write to a file.
+// Read 'man 2 write'
+static void myfs_write(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi){
+  write_log("myfs_write(ino=%lu, buf=0x%08x, size=%d, offset=%lld, fi=0x%08x)\n", ino, buf, size, offset, fi);
 
-  struct my_user user = get_context_user();
+  if (offset >= MY_MAX_FILE_SIZE) {
+    // cannot writer beyond the maximum file size
+    write_log("myfs_write - EFBIG\n");
+    fuse_reply_err(req, EFBIG);
+    return;
 
-  // try to find the file by its path
-  struct my_fcb file_fcb;
-  int result = find_file(path, user, &file_fcb);
+  } else if ((offset + size) > MY_MAX_FILE_SIZE) {
+    // cannot write beyond the maximum file size, but can write until it
+    size = MY_MAX_FILE_SIZE - offset;
+  }
 
-  if (
-    result == MYFS_FIND_NO_DIR ||
-    result == MYFS_FIND_NO_FILE
-  ) {
-    // file does not exist
-    write_log("myfs_chmod - ENOENT\n");
-    return -ENOENT;
+  // writes to the file exclude each other and its readers
+  uuid_t id;
 
-  } else if (result == MYFS_FIND_NO_ACCESS) {
-    // file cannot be accessed
-    write_log("myfs_getattr - EACCES\n");
-    return -EACCES;
+  if (!lock_inode(ino, 1, id)) {
+    write_log("myfs_write - EBADF\n");
+    fuse_reply_err(req, EBADF);
+    return;
   }
 
-  // update the FCB and write it to the database
-  file_fcb.uid = uid;
-  file_fcb.gid = gid;
-  file_fcb.ctime = time(0);
-  update_file(&file_fcb);
+  if (!buffer_file_write(fi->fh, buf, size, offset)) {
+    // get the FCB by the file handle and write the data
+    struct my_fcb file_fcb;
+    get_open_file(fi->fh, &file_fcb);
 
-  return 0;
+    write_file_data(&file_fcb, (char*)buf, size, offset);
+  }
+
+  // fdatasync has to commit the write, even if it is still buffered
+  mark_file_data_changed(id);
+
+  unlock_fcb(id);
+
+  // small writes are collected in the write buffer of the file handle, they
+  // will be written to the database together with the following writes
+  fuse_reply_write(req, size);
 }
 
 // Create a directory.
 // Read 'man 2 mkdir'.
-static int myfs_mkdir(const char *path, mode_t mode){
-  write_log("myfs_mkdir: %s\n", path);
+static void myfs_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode){
+  write_log("myfs_mkdir(parent=%lu, name=\"%s\", mode=0%03o)\n", parent, name, mode);
+
+  struct my_user user = get_request_user(req);
 
   struct my_fcb parent_fcb;
   struct my_fcb dir_fcb;
 
-  // try to find the directory and its parent directory by its path
-  int result = find_dir_entry(path, get_context_user(), &parent_fcb, &dir_fcb);
+  // the parent directory is locked until the directory is added to it
+  if (lock_inode_file(parent, 1, &parent_fcb) < 0) {
+    // parent directory does not exist anymore
+    write_log("myfs_mkdir - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+
+  // try to find the directory to check if it exists
+  int result = find_dir_child(&parent_fcb, name, user, &dir_fcb);
 
   if (result == MYFS_FIND_NO_DIR) {
-    // parent directory does not exist
-    write_log("myfs_mkdir - ENOENT\n");
-    return -ENOENT;
+    // parent is not a directory
+    unlock_fcb(parent_fcb.id);
+    write_log("myfs_mkdir - ENOTDIR\n");
+    fuse_reply_err(req, ENOTDIR);
+    return;
 
   } else if (result == MYFS_FIND_FOUND) {
     // directory already exists
+    unlock_fcb(parent_fcb.id);
     write_log("myfs_mkdir - EEXIST\n");
-    return -EEXIST;
+    fuse_reply_err(req, EEXIST);
+    return;
 
   } else if (result == MYFS_FIND_NO_ACCESS) {
     // user cannot access the parent directory
+    unlock_fcb(parent_fcb.id);
     write_log("myfs_mkdir - EACCES\n");
-    return -EACCES;
+    fuse_reply_err(req, EACCES);
+    return;
+  }
 
-  } else {
-    // create a new directory and write it to the database
-    create_directory(mode, get_context_user(), &dir_fcb);
-
-    // get the directory name from the path and add the directory to the parent directory
-    // path string needs to be duplicated because it will be modified by path_file_name
-    char* path_dup = strdup(path);
-    char* dir_name = path_file_name(path_dup);
-    int result = link_file(&parent_fcb, &dir_fcb, dir_name);
-    free(path_dup);
-
-    if (result < 0) {
-      // the parent directory does not have space left to add the directory
-      remove_file(&dir_fcb);
-      write_log("myfs_mkdir - EFBIG\n");
-      return -EFBIG;
-    }
+  // create a new directory and write it to the database
+  create_directory(mode, user, &dir_fcb);
 
-    return 0;
+  if (link_file(&parent_fcb, &dir_fcb, name) < 0) {
+    // the parent directory does not have space left to add the directory
+    remove_file(&dir_fcb);
+    unlock_fcb(parent_fcb.id);
+    write_log("myfs_mkdir - EFBIG\n");
+    fuse_reply_err(req, EFBIG);
+    return;
   }
+
+  unlock_fcb(parent_fcb.id);
+
+  reply_file_entry(req, &dir_fcb);
 }
 
 // Delete a file.
 // Read 'man 2 unlink'.
-static int myfs_unlink(const char *path){
-  write_log("myfs_unlink: %s\n",path);
+static void myfs_unlink(fuse_req_t req, fuse_ino_t parent, const char *name){
+  write_log("myfs_unlink(parent=%lu, name=\"%s\")\n", parent, name);
+
+  struct my_user user = get_request_user(req);
 
   struct my_fcb dir_fcb;
   struct my_fcb file_fcb;
 
-  // try to find the file and its parent directory by its path
-  int result = find_dir_entry(path, get_context_user(), &dir_fcb, &file_fcb);
+  if (lock_inode_file(parent, 1, &dir_fcb) < 0) {
+    // parent directory does not exist anymore
+    write_log("myfs_unlink - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
 
-  if (
-    result == MYFS_FIND_NO_DIR ||
-    result == MYFS_FIND_NO_FILE
-  ) {
+  // try to find the file in the directory
+  int result = find_dir_child(&dir_fcb, name, user, &file_fcb);
+
+  if (result == MYFS_FIND_NO_DIR || result == MYFS_FIND_NO_FILE) {
     // file does not exist
+    unlock_fcb(dir_fcb.id);
     write_log("myfs_unlink - ENOENT\n");
-    return -ENOENT;
+    fuse_reply_err(req, ENOENT);
+    return;
 
-  } else if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !can_write(&dir_fcb, get_context_user())
-  ) {
+  } else if (result == MYFS_FIND_NO_ACCESS || !can_write(&dir_fcb, user)) {
     // user cannot access the file or write to the parent directory
+    unlock_fcb(dir_fcb.id);
     write_log("myfs_unlink - EACCES\n");
-    return -EACCES;
+    fuse_reply_err(req, EACCES);
+    return;
 
   } else if (!is_file(&file_fcb)) {
     // the file is not a regular file
+    unlock_fcb(dir_fcb.id);
     write_log("myfs_unlink - EPERM\n");
-    return -EPERM;
+    fuse_reply_err(req, EPERM);
+    return;
   }
 
-  // get the file name from the path and remove the file from the parent directory
-  // path string needs to be duplicated because it will be modified by path_file_name
+  // remove the file from the parent directory
   // if no other links point to the file and it is not open, it will be deleted
-  char* path_dup = strdup(path);
-  char* file_name = path_file_name(path_dup);
-  unlink_file(&dir_fcb, &file_fcb, file_name);
-  free(path_dup);
+  lock_child_file(&file_fcb);
+  unlink_file(&dir_fcb, &file_fcb, name);
+  unlock_fcb(file_fcb.id);
+  unlock_fcb(dir_fcb.id);
 
-  return 0;
+  fuse_reply_err(req, 0);
 }
 
 // Delete a directory.
 // Read 'man 2 rmdir'.
-static int myfs_rmdir(const char *path){
-  write_log("myfs_rmdir: %s\n",path);
+static void myfs_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name){
+  write_log("myfs_rmdir(parent=%lu, name=\"%s\")\n", parent, name);
+
+  struct my_user user = get_request_user(req);
 
   struct my_fcb parent_fcb;
   struct my_fcb dir_fcb;
 
-  // try to find the drectory and its parent directory by its path
-  int result = find_dir_entry(path, get_context_user(), &parent_fcb, &dir_fcb);
+  if (lock_inode_file(parent, 1, &parent_fcb) < 0) {
+    // parent directory does not exist anymore
+    write_log("myfs_rmdir - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
 
-  if (
-    result == MYFS_FIND_NO_DIR ||
-    result == MYFS_FIND_NO_FILE
-  ) {
+  // try to find the directory in the parent directory
+  int result = find_dir_child(&parent_fcb, name, user, &dir_fcb);
+
+  if (result == MYFS_FIND_NO_DIR || result == MYFS_FIND_NO_FILE) {
     // directory does not exist
+    unlock_fcb(parent_fcb.id);
     write_log("myfs_rmdir - ENOENT\n");
-    return -ENOENT;
+    fuse_reply_err(req, ENOENT);
+    return;
 
-  } else if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !can_write(&parent_fcb, get_context_user())
-  ) {
+  } else if (result == MYFS_FIND_NO_ACCESS || !can_write(&parent_fcb, user)) {
     // user cannot access the directory or write to the parent directory
+    unlock_fcb(parent_fcb.id);
     write_log("myfs_rmdir - EACCES\n");
-    return -EACCES;
+    fuse_reply_err(req, EACCES);
+    return;
 
   } else if (!is_directory(&dir_fcb)) {
     // the found FCB is not a directory
+    unlock_fcb(parent_fcb.id);
     write_log("myfs_rmdir - ENOTDIR\n");
-    return -ENOTDIR;
+    fuse_reply_err(req, ENOTDIR);
+    return;
+  }
 
-  } else if (get_directory_size(&dir_fcb) != 0) {
+  // no entries can be added to the directory while it is checked and removed
+  lock_child_file(&dir_fcb);
+
+  if (get_directory_size(&dir_fcb) != 0) {
     // the directory is not empty
+    unlock_fcb(dir_fcb.id);
+    unlock_fcb(parent_fcb.id);
     write_log("myfs_rmdir - ENOTEMPTY\n");
-    return -ENOTEMPTY;
+    fuse_reply_err(req, ENOTEMPTY);
+    return;
   }
 
-  // get the directory name from the path and remove the directory from the parent directory
-  // path string needs to be duplicated because it will be modified by path_file_name
+  // remove the directory from the parent directory
   // if the directory is not open, it will be deleted
-  char* path_dup = strdup(path);
-  char* file_name = path_file_name(path_dup);
-  unlink_file(&parent_fcb, &dir_fcb, file_name);
-  free(path_dup);
+  unlink_file(&parent_fcb, &dir_fcb, name);
+  unlock_fcb(dir_fcb.id);
+  unlock_fcb(parent_fcb.id);
 
-  return 0;
+  fuse_reply_err(req, 0);
 }
 
 // Create a hard link to the file.
 // Read 'man 2 link'.
-static int myfs_link(const char* from, const char* to) {
-  write_log("myfs_link(from=\"%s\", to=\"%s\")\n", from, to);
-  int result;
+static void myfs_link(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname){
+  write_log("myfs_link(ino=%lu, newparent=%lu, newname=\"%s\")\n", ino, newparent, newname);
 
-  // try to find the linked file
-  struct my_fcb from_fcb;
-  result = find_file(from, get_context_user(), &from_fcb);
+  struct my_user user = get_request_user(req);
 
-  if (result == MYFS_FIND_NO_ACCESS) {
-    // user cannot access the linked file's parent directory
-    write_log("myfs_link - EACCES\n");
-    return -EACCES;
+  struct my_fcb from_fcb;
+  struct my_fcb dir_fcb;
+  struct my_fcb to_fcb;
 
-  } else if (result != MYFS_FIND_FOUND) {
-    // linked file does not exist
+  if (read_inode_file(ino, &from_fcb) < 0 || lock_inode_file(newparent, 1, &dir_fcb) < 0) {
+    // linked file or parent directory for the link does not exist anymore
     write_log("myfs_link - ENOENT\n");
-    return -ENOENT;
+    fuse_reply_err(req, ENOENT);
+    return;
 
   } else if (is_directory(&from_fcb)) {
     // linked file is a directory
+    unlock_fcb(dir_fcb.id);
     write_log("myfs_link - EPERM\n");
-    return -EPERM;
+    fuse_reply_err(req, EPERM);
+    return;
   }
 
-  struct my_fcb to_fcb;
-  struct my_fcb dir_fcb;
-
   // try to find the file that would be replaced by the link
-  result = find_dir_entry(to, get_context_user(), &dir_fcb, &to_fcb);
+  int result = find_dir_child(&dir_fcb, newname, user, &to_fcb);
 
   if (result == MYFS_FIND_NO_DIR) {
-    // parent directory for the link does not exist
-    write_log("myfs_link - ENOENT\n");
-    return -ENOENT;
+    // parent for the link is not a directory
+    unlock_fcb(dir_fcb.id);
+    write_log("myfs_link - ENOTDIR\n");
+    fuse_reply_err(req, ENOTDIR);
+    return;
 
   } else if (result == MYFS_FIND_NO_ACCESS) {
     // user cannot access the parent directory
+    unlock_fcb(dir_fcb.id);
     write_log("myfs_link - EACCES\n");
-    return -EACCES;
+    fuse_reply_err(req, EACCES);
+    return;
 
   } else if (result == MYFS_FIND_FOUND) {
-    // there is already a file on this path that would be replaced
+    // there is already a file with this name that would be replaced
+    unlock_fcb(dir_fcb.id);
     write_log("myfs_link - EEXIST\n");
-    return -EEXIST;
+    fuse_reply_err(req, EEXIST);
+    return;
+  }
 
-  } else {
-    // get the link file name from the path and add the link to the parent directory
-    // path string needs to be duplicated because it will be modified by path_file_name
-    char* to_path_dup = strdup(to);
-    char* file_name = path_file_name(to_path_dup);
-    result = link_file(&dir_fcb, &from_fcb, file_name);
-    free(to_path_dup);
-
-    if (result < 0) {
-      // the parent directory does not have space left to add the link
-      write_log("myfs_link - EFBIG\n");
-      return -EFBIG;
-    }
+  // the number of links of the file changes, files are locked after directories
+  lock_child_file(&from_fcb);
+  result = link_file(&dir_fcb, &from_fcb, newname);
+  unlock_fcb(from_fcb.id);
+  unlock_fcb(dir_fcb.id);
 
-    return 0;
+  if (result < 0) {
+    // the parent directory does not have space left to add the link
+    write_log("myfs_link - EFBIG\n");
+    fuse_reply_err(req, EFBIG);
+    return;
+  }
+
+  // the link shares the inode with the linked file
+  reply_file_entry(req, &from_fcb);
+}
+
+/**
+ * @brief Unlocks the directories locked by rename
+ * @param from_dir Pointer to the FCB of the original directory
+ * @param to_dir Pointer to the FCB of the destination directory, can be the same
+ */
+static void unlock_rename_dirs(struct my_fcb* from_dir, struct my_fcb* to_dir) {
+  if (to_dir != from_dir) {
+    unlock_fcb(to_dir->id);
   }
+
+  unlock_fcb(from_dir->id);
 }
 
 // Rename the file.
 // Read 'man 2 rename'
-static int myfs_rename(const char* from, const char* to) {
-  write_log("myfs_rename(from=\"%s\", to=\"%s\")\n", from, to);
-  int result;
+static void myfs_rename(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname){
+  write_log("myfs_rename(parent=%lu, name=\"%s\", newparent=%lu, newname=\"%s\")\n", parent, name, newparent, newname);
+
+  struct my_user user = get_request_user(req);
 
-  // try to find the renamed file
   struct my_fcb from_dir;
   struct my_fcb from_file;
-  result = find_dir_entry(from, get_context_user(), &from_dir, &from_file);
+  struct my_fcb to_dir_fcb;
+  struct my_fcb to_file;
 
-  if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !can_write(&from_dir, get_context_user())
-  ) {
+  // if both directories are the same, only one FCB is used for them, otherwise
+  // changing one of the copies would not change the other one
+  struct my_fcb* to_dir = (newparent == parent) ? &from_dir : &to_dir_fcb;
+
+  uuid_t from_id, to_id;
+
+  if (!get_inode_id(parent, from_id) || !get_inode_id(newparent, to_id)) {
+    // one of the parent directories is not known
+    write_log("myfs_rename - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+
+  // two different directories are always locked in the order of their UUIDs,
+  // so that two renames between them cannot wait for each other
+  char same_dir = uuid_compare(from_id, to_id) == 0;
+  char to_first = uuid_compare(to_id, from_id) < 0;
+
+  if (to_first) lock_fcb(to_id, 1);
+  lock_fcb(from_id, 1);
+  if (!same_dir && !to_first) lock_fcb(to_id, 1);
+
+  if (read_file(&from_id, &from_dir) != 0 || read_file(&to_id, to_dir) != 0) {
+    // one of the parent directories does not exist anymore
+    unlock_fcb(from_id);
+    if (!same_dir) unlock_fcb(to_id);
+    write_log("myfs_rename - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+  }
+
+  // try to find the renamed file
+  int result = find_dir_child(&from_dir, name, user, &from_file);
+
+  if (result == MYFS_FIND_NO_ACCESS || !can_write(&from_dir, user)) {
     // user cannot access or write to the original parent directory
+    unlock_rename_dirs(&from_dir, to_dir);
     write_log("myfs_rename - EACCES\n");
-    return -EACCES;
+    fuse_reply_err(req, EACCES);
+    return;
+
   } else if (result != MYFS_FIND_FOUND) {
     // renamed file does not exist
+    unlock_rename_dirs(&from_dir, to_dir);
     write_log("myfs_rename - ENOENT\n");
-    return -ENOENT;
+    fuse_reply_err(req, ENOENT);
+    return;
   }
 
   // try to find the file that would be replaced
-  struct my_fcb to_dir;
-  struct my_fcb to_file;
-  result = find_dir_entry(to, get_context_user(), &to_dir, &to_file);
+  result = find_dir_child(to_dir, newname, user, &to_file);
 
   if (result == MYFS_FIND_NO_DIR) {
-    // parent directory does not exist
-    write_log("myfs_rename - ENOENT\n");
-    return -ENOENT;
-  }
+    // destination parent is not a directory
+    unlock_rename_dirs(&from_dir, to_dir);
+    write_log("myfs_rename - ENOTDIR\n");
+    fuse_reply_err(req, ENOTDIR);
+    return;
 
-  if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !can_write(&to_dir, get_context_user())
-  ) {
+  } else if (result == MYFS_FIND_NO_ACCESS || !can_write(to_dir, user)) {
     // user cannot access or write to the destination parent directory
+    unlock_rename_dirs(&from_dir, to_dir);
     write_log("myfs_rename - EACCES\n");
-    return -EACCES;
+    fuse_reply_err(req, EACCES);
+    return;
   }
 
-  // get the file names of the original and renamed files
-  char* to_dup = strdup(to);
-  char* to_file_name = path_file_name(to_dup);
-
-  char* from_dup = strdup(from);
-  char* from_file_name = path_file_name(from_dup);
-
   // if there is already a file at the destination, remove it
   if (result == MYFS_FIND_FOUND) {
-    unlink_file(&to_dir, &to_file, to_file_name);
+    lock_child_file(&to_file);
+    unlink_file(to_dir, &to_file, newname);
+    unlock_fcb(to_file.id);
   }
 
   // remove the file from original directory and add it to the destination directory
-  if (uuid_compare(from_dir.id, to_dir.id) == 0) {
-    // if these directories are the same, it means that both from_dir and to_dir
-    // contain the same FCB, but if we change one, the other one does not change
-    // we need to make sure to use only one of the FCBs in this case
-    remove_dir_entry(&from_dir, from_file_name);
-    result = add_dir_entry(&from_dir, &from_file, to_file_name);
-  } else {
-    remove_dir_entry(&from_dir, from_file_name);
-    result = add_dir_entry(&to_dir, &from_file, to_file_name);
-  }
+  remove_dir_entry(&from_dir, name);
+  result = add_dir_entry(to_dir, &from_file, newname);
 
-  free(to_dup);
-  free(from_dup);
+  unlock_rename_dirs(&from_dir, to_dir);
 
   if (result < 0) {
     // unable to add directory entry because the directory is too big
     write_log("myfs_rename - EFBIG\n");
-    return -EFBIG;
+    fuse_reply_err(req, EFBIG);
+    return;
   }
 
-  return 0;
+  fuse_reply_err(req, 0);
 }
 
 // Open a file. Open should check if the operation is permitted for the given flags (fi->flags).
 // Read 'man 2 open'.
-static int myfs_open(const char *path, struct fuse_file_info *fi){
-  write_log("myfs_open(path\"%s\", fi=0x%08x)\n", path, fi);
+static void myfs_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  write_log("myfs_open(ino=%lu, fi=0x%08x)\n", ino, fi);
 
-  struct my_user user = get_context_user();
+  struct my_user user = get_request_user(req);
   struct my_fcb file_fcb;
 
-  // try to find the file by its path
-  int result = find_file(path, user, &file_fcb);
-
-  if (
-    result == MYFS_FIND_NO_DIR ||
-    result == MYFS_FIND_NO_FILE ||
-    !is_file(&file_fcb)
-  ) {
-    // the file does not exist or is not a file
+  // the file cannot be deleted by unlink while it is being opened
+  if (lock_inode_file(ino, 0, &file_fcb) < 0) {
+    // the file does not exist anymore
     write_log("myfs_open - ENOENT\n");
-    return -ENOENT;
+    fuse_reply_err(req, ENOENT);
+    return;
 
-  } else if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !check_open_flags(&file_fcb, user, fi->flags)
-  ) {
-    // user cannot access the parent directory, or the opened file with the
-    // specified flags
+  } else if (!is_file(&file_fcb)) {
+    // the file is not a regular file
+    unlock_fcb(file_fcb.id);
+    write_log("myfs_open - EISDIR\n");
+    fuse_reply_err(req, EISDIR);
+    return;
+
+  } else if (!check_open_flags(&file_fcb, user, fi->flags)) {
+    // user cannot access the opened file with the specified flags
+    unlock_fcb(file_fcb.id);
     write_log("myfs_open - EACCES\n");
-    return -EACCES;
+    fuse_reply_err(req, EACCES);
+    return;
   }
 
-  // open the file after creating it
+  // add the file to the open file table
   int fh = add_open_file(&file_fcb);
+  unlock_fcb(file_fcb.id);
 
   if (fh < 0) {
     // too many files are open
     write_log("myfs_open - ENFILE\n");
-    return -ENFILE;
+    fuse_reply_err(req, ENFILE);
+    return;
   }
 
   // save the file handle for future calls
   fi->fh = fh;
 
-  return 0;
+  if (fuse_reply_open(req, fi) != 0) {
+    // the open was interrupted, there will be no release
+    lock_fcb(file_fcb.id, 1);
+    remove_open_file(fh);
+    unlock_fcb(file_fcb.id);
+  }
+}
+
+/**
+ * @brief Closes a file handle with the file locked
+ *
+ * Buffered writes are flushed and the file is deleted if it was unlinked
+ * while it was open.
+ *
+ * @param ino Inode number of the file
+ * @param fh File handle
+ */
+static void release_locked_file(fuse_ino_t ino, int fh) {
+  uuid_t id;
+  char locked = lock_inode(ino, 1, id);
+
+  remove_open_file(fh);
+
+  if (locked) {
+    unlock_fcb(id);
+  }
 }
 
 // Release the file. There will be one call to release for each call to open.
-static int myfs_release(const char *path, struct fuse_file_info *fi){
-  write_log("myfs_release(path=\"%s\", fi=0x%08x)\n", path, fi);
+static void myfs_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  write_log("myfs_release(ino=%lu, fi=0x%08x)\n", ino, fi);
 
   // remove the file from the open file table
   // if there are no other links pointing to it and is not open anywhere else,
   // it will be deleted
-  remove_open_file(fi->fh);
+  release_locked_file(ino, fi->fh);
 
-  return 0;
+  fuse_reply_err(req, 0);
 }
 
-static int myfs_opendir(const char *path, struct fuse_file_info *fi){
-  write_log("myfs_opendir(path\"%s\", fi=0x%08x)\n", path, fi);
+// Flush the file. There will be one call to flush for each close of a file descriptor.
+// Read 'man 2 close'.
+static void myfs_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  write_log("myfs_flush(ino=%lu, fi=0x%08x)\n", ino, fi);
 
-  struct my_user user = get_context_user();
-  struct my_fcb dir_fcb;
+  // write the data buffered in the file handle to the database
+  // closing does not make the data durable, it is committed with the group
+  // unless the application calls fsync
+  uuid_t id;
+
+  if (lock_inode(ino, 1, id)) {
+    flush_write_buffer(fi->fh);
+    unlock_fcb(id);
+  }
 
-  // try to find the directory by its path
-  int result = find_file(path, user, &dir_fcb);
+  fuse_reply_err(req, 0);
+}
 
-  if (
-    result == MYFS_FIND_NO_DIR ||
-    result == MYFS_FIND_NO_FILE ||
-    !is_directory(&dir_fcb)
-  ) {
-    // the directory does not exist, or is not a directory
-    write_log("myfs_open - ENOENT\n");
-    return -ENOENT;
+// Synchronise the file contents.
+// Read 'man 2 fsync'.
+static void myfs_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi){
+  write_log("myfs_fsync(ino=%lu, datasync=%d, fi=0x%08x)\n", ino, datasync, fi);
 
-  } else if (
-    result == MYFS_FIND_NO_ACCESS ||
-    !check_open_flags(&dir_fcb, user, fi->flags)
-  ) {
-    // the user cannot access a parent directory, or cannot open the directory
-    // wit the specified flags
-    write_log("myfs_open - EACCES\n");
-    return -EACCES;
+  // write the data buffered in all handles of the file to the database
+  begin_db_operation();
+
+  uuid_t id;
+  char found = lock_inode(ino, 1, id);
+
+  if (found) {
+    flush_file_buffers(id);
+    unlock_fcb(id);
+  }
+
+  end_db_operation();
+
+  // fdatasync does not need a commit for changed timestamps or mode, only for
+  // the data and size, which may have been changed through any handle
+  if (!datasync || !found || !is_file_data_synced(id)) {
+    sync_db();
+  }
+
+  fuse_reply_err(req, 0);
+}
+
+// Synchronise the directory contents.
+// Read 'man 2 fsync'.
+static void myfs_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info *fi){
+  write_log("myfs_fsyncdir(ino=%lu, datasync=%d, fi=0x%08x)\n", ino, datasync, fi);
+
+  // directory entries are changed by operations which already finished
+  sync_db();
+
+  fuse_reply_err(req, 0);
+}
+
+static void myfs_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  write_log("myfs_opendir(ino=%lu, fi=0x%08x)\n", ino, fi);
+
+  struct my_user user = get_request_user(req);
+  struct my_fcb dir_fcb;
+
+  // the directory cannot be deleted by rmdir while it is being opened
+  if (lock_inode_file(ino, 0, &dir_fcb) < 0) {
+    // the directory does not exist anymore
+    write_log("myfs_opendir - ENOENT\n");
+    fuse_reply_err(req, ENOENT);
+    return;
+
+  } else if (!is_directory(&dir_fcb)) {
+    // the file is not a directory
+    unlock_fcb(dir_fcb.id);
+    write_log("myfs_opendir - ENOTDIR\n");
+    fuse_reply_err(req, ENOTDIR);
+    return;
+
+  } else if (!check_open_flags(&dir_fcb, user, fi->flags)) {
+    // the user cannot open the directory with the specified flags
+    unlock_fcb(dir_fcb.id);
+    write_log("myfs_opendir - EACCES\n");
+    fuse_reply_err(req, EACCES);
+    return;
   }
 
   // add the directory to the open file table
   int fh = add_open_file(&dir_fcb);
+  unlock_fcb(dir_fcb.id);
 
   if (fh < 0) {
     // too many files are open
     write_log("myfs_opendir - ENFILE\n");
-    return -ENFILE;
+    fuse_reply_err(req, ENFILE);
+    return;
   }
 
   // save the file for future calls
   fi->fh = fh;
 
-  return 0;
+  if (fuse_reply_open(req, fi) != 0) {
+    // the open was interrupted, there will be no releasedir
+    lock_fcb(dir_fcb.id, 1);
+    remove_open_file(fh);
+    unlock_fcb(dir_fcb.id);
+  }
 }
 
 // Release the directory. There will be one call to releasedir for each call to opendir.
-static int myfs_releasedir(const char *path, struct fuse_file_info *fi){
-  write_log("myfs_release(path=\"%s\", fi=0x%08x)\n", path, fi);
+static void myfs_releasedir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  write_log("myfs_releasedir(ino=%lu, fi=0x%08x)\n", ino, fi);
 
   // remove the directory from the open file table
   // if there are no other links pointing to it and is not open anywhere else,
   // it will be deleted
-  remove_open_file(fi->fh);
+  release_locked_file(ino, fi->fh);
 
-  return 0;
+  fuse_reply_err(req, 0);
 }
 
-static struct fuse_operations myfs_oper = {
-  .getattr = myfs_getattr,
-  .readdir = myfs_readdir,
-  .open = myfs_open,
-  .opendir = myfs_opendir,
-  .read = myfs_read,
-  .create = myfs_create,
-  .utime = myfs_utime,
-  .write = myfs_write,
-  .truncate = myfs_truncate,
-  .release = myfs_release,
-  .releasedir = myfs_releasedir,
-  .unlink = myfs_unlink,
-  .mkdir = myfs_mkdir,
-  .rmdir = myfs_rmdir,
-  .chmod = myfs_chmod,
-  .chown = myfs_chown,
-  .link = myfs_link,
-  .rename = myfs_rename,
-};
+// Get file system statistics, answered from the usage counters without a scan.
+// Read 'man 2 statfs'.
+static void myfs_statfs(fuse_req_t req, fuse_ino_t ino){
+  write_log("myfs_statfs(ino=%lu)\n", ino);
 
-void read_db_object(uuid_t key, void* buffer, size_t size) {
-  // separate variable for size is required because unqlite will store
-  // the read size in it
-  unqlite_int64 unqlite_size = size;
-  int rc = unqlite_kv_fetch(pDb, key, KEY_SIZE, buffer, &unqlite_size);
-  error_handler(rc);
-}
+  struct statvfs stbuf;
+  get_usage_stat(&stbuf);
 
-void write_db_object(uuid_t key, void* buffer, size_t size) {
-  int rc = unqlite_kv_store(pDb, key, KEY_SIZE, buffer, size);
-  error_handler(rc);
+  fuse_reply_statfs(req, &stbuf);
 }
 
-void delete_db_object(uuid_t key) {
-  int rc = unqlite_kv_delete(pDb, key, KEY_SIZE);
-  error_handler(rc);
-}
+/*
+ * Requests which can change the database are counted as operations of the
+ * group commit, so a commit never contains only a part of a request. Lookups,
+ * getattr and read are among them, because they flush buffered writes, and so
+ * are opens, which release the file if the reply fails. Fsync counts its own
+ * operation, it has to wait for the commit after the operation finishes.
+ */
 
-char has_db_object(uuid_t key) {
-  unqlite_int64 unqlite_size;
-  // NULL is used as the buffer to prevent actually reading the object
-  int rc = unqlite_kv_fetch(pDb, key, KEY_SIZE, NULL, &unqlite_size);
+static void myfs_lookup_op(fuse_req_t req, fuse_ino_t parent, const char *name){
+  begin_db_operation();
+  myfs_lookup(req, parent, name);
+  end_db_operation();
+}
 
-  if (rc == UNQLITE_OK) {
-    return 1;
-  } else if (rc == UNQLITE_NOTFOUND) {
-    return 0;
-  } else {
-    error_handler(rc);
-  }
+static void myfs_getattr_op(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_getattr(req, ino, fi);
+  end_db_operation();
 }
 
-void create_directory(mode_t mode, struct my_user user, struct my_fcb *dir_fcb) {
-  dir_fcb->uid = user.uid;
-  dir_fcb->gid = user.gid;
-  dir_fcb->mode = S_IFDIR|mode;
-  dir_fcb->mtime = time(0);
-  dir_fcb->ctime = time(0);
-  dir_fcb->size = 0;
-  dir_fcb->nlink = 0;
+static void myfs_setattr_op(fuse_req_t req, fuse_ino_t ino, struct stat *attr, int to_set, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_setattr(req, ino, attr, to_set, fi);
+  end_db_operation();
+}
 
-  // create uuids for the FCB and index block
-  uuid_generate(dir_fcb->id);
-  uuid_generate(dir_fcb->data);
+static void myfs_open_op(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_open(req, ino, fi);
+  end_db_operation();
+}
 
-  // write the FCB to the database
-  write_db_object(dir_fcb->id, dir_fcb, sizeof(struct my_fcb));
+static void myfs_opendir_op(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_opendir(req, ino, fi);
+  end_db_operation();
+}
 
-  // create an empty index block and write it to the database
-  struct my_index index_block;
-  write_db_object(dir_fcb->data, &index_block, sizeof(index_block));
+static void myfs_read_op(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_read(req, ino, size, offset, fi);
+  end_db_operation();
+}
 
-  // create an empty directory header and write it to the database
-  struct my_dir_header dir_header = {0, -1};
-  write_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+static void myfs_create_op(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_create(req, parent, name, mode, fi);
+  end_db_operation();
 }
 
-void create_file(mode_t mode, struct my_user user, struct my_fcb* file_fcb) {
-  file_fcb->uid = user.uid;
-  file_fcb->gid = user.gid;
-  file_fcb->mode = S_IFREG|mode;
-  file_fcb->mtime = time(0);
-  file_fcb->ctime = time(0);
-  file_fcb->size = 0;
-  file_fcb->nlink = 0;
+static void myfs_write_op(fuse_req_t req, fuse_ino_t ino, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_write(req, ino, buf, size, offset, fi);
+  end_db_operation();
+}
 
-  // create uuids for the FCB and index block
-  uuid_generate(file_fcb->id);
-  uuid_generate(file_fcb->data);
+static void myfs_release_op(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_release(req, ino, fi);
+  end_db_operation();
+}
 
-  // write the FCB to the database
-  write_db_object(file_fcb->id, file_fcb, sizeof(struct my_fcb));
+static void myfs_flush_op(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_flush(req, ino, fi);
+  end_db_operation();
+}
 
-  // create an empty index block and write it to the database
-  struct my_index index_block;
-  write_db_object(file_fcb->data, &index_block, sizeof(index_block));
+static void myfs_releasedir_op(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi){
+  begin_db_operation();
+  myfs_releasedir(req, ino, fi);
+  end_db_operation();
 }
 
-int read_file(uuid_t *id, struct my_fcb* file_fcb) {
-  if (has_db_object(*id)) {
-    read_db_object(*id, file_fcb, sizeof(struct my_fcb));
-    return 0;
+static void myfs_unlink_op(fuse_req_t req, fuse_ino_t parent, const char *name){
+  begin_db_operation();
+  myfs_unlink(req, parent, name);
+  end_db_operation();
+}
 
-  } else {
-    return -1;
-  }
+static void myfs_mkdir_op(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode){
+  begin_db_operation();
+  myfs_mkdir(req, parent, name, mode);
+  end_db_operation();
 }
 
-void update_file(struct my_fcb* file_fcb) {
-  write_db_object(file_fcb->id, file_fcb, sizeof(struct my_fcb));
+static void myfs_rmdir_op(fuse_req_t req, fuse_ino_t parent, const char *name){
+  begin_db_operation();
+  myfs_rmdir(req, parent, name);
+  end_db_operation();
 }
 
-size_t size_round_up_to(size_t num, size_t up_to) {
-  size_t rem = num % up_to;
+static void myfs_link_op(fuse_req_t req, fuse_ino_t ino, fuse_ino_t newparent, const char *newname){
+  begin_db_operation();
+  myfs_link(req, ino, newparent, newname);
+  end_db_operation();
+}
 
-  if (rem > 0) {
-    // add to the number so that it is a multiple of up_to
-    return num + (up_to - rem);
-  } else {
-    return num;
-  }
+static void myfs_rename_op(fuse_req_t req, fuse_ino_t parent, const char *name, fuse_ino_t newparent, const char *newname){
+  begin_db_operation();
+  myfs_rename(req, parent, name, newparent, newname);
+  end_db_operation();
 }
 
-size_t size_round_down_to(size_t num, size_t up_to) {
-  size_t rem = num % up_to;
+static struct fuse_opt myfs_opts[] = {
+  {"cache_blocks=%d", offsetof(struct my_options, cache_blocks), 0},
+  {"cache_fcbs=%d", offsetof(struct my_options, cache_fcbs), 0},
+  {"cache_dentries=%d", offsetof(struct my_options, cache_dentries), 0},
+  {"readahead_blocks=%d", offsetof(struct my_options, readahead_blocks), 0},
+  {"commit_ops=%d", offsetof(struct my_options, commit_ops), 0},
+  {"commit_interval=%d", offsetof(struct my_options, commit_interval), 0},
+  FUSE_OPT_END
+};
 
-  // subtract from the number so that it is a multiple of up_to
-  return num - rem;
+static struct fuse_lowlevel_ops myfs_oper = {
+  .lookup = myfs_lookup_op,
+  .forget = myfs_forget,
+  .getattr = myfs_getattr_op,
+  .setattr = myfs_setattr_op,
+  .readdir = myfs_readdir,
+  .open = myfs_open_op,
+  .opendir = myfs_opendir_op,
+  .read = myfs_read_op,
+  .create = myfs_create_op,
+  .write = myfs_write_op,
+  .release = myfs_release_op,
+  .flush = myfs_flush_op,
+  .fsync = myfs_fsync,
+  .fsyncdir = myfs_fsyncdir,
+  .releasedir = myfs_releasedir_op,
+  .unlink = myfs_unlink_op,
+  .mkdir = myfs_mkdir_op,
+  .rmdir = myfs_rmdir_op,
+  .link = myfs_link_op,
+  .rename = myfs_rename_op,
+  .statfs = myfs_statfs,
+};
+
+/**
+ * @brief Initialises the mutexes of the shared structures as recursive
+ */
+static void init_locks() {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+
+  pthread_mutex_init(&block_cache_lock, &attr);
+  pthread_mutex_init(&fcb_cache_lock, &attr);
+  pthread_mutex_init(&dentry_cache_lock, &attr);
+  pthread_mutex_init(&inode_table_lock, &attr);
+  pthread_mutex_init(&open_files_lock, &attr);
+  pthread_mutex_init(&fcb_locks_lock, &attr);
+  pthread_mutex_init(&db_lock, &attr);
+
+  pthread_mutexattr_destroy(&attr);
 }
 
-int get_num_blocks(size_t size) {
-  return size_round_up_to(size, MY_BLOCK_SIZE) / MY_BLOCK_SIZE;
+/**
+ * @brief Locks one of the mutexes of the shared structures
+ * @param mutex Pointer to the mutex
+ */
+static void lock_mutex(pthread_mutex_t* mutex) {
+  pthread_once(&locks_once, init_locks);
+  pthread_mutex_lock(mutex);
 }
 
-void get_block_indexes(size_t size, off_t offset, int* first, int* last) {
-  *first = size_round_down_to(offset, MY_BLOCK_SIZE) / MY_BLOCK_SIZE;
-  *last = size_round_up_to(offset + size, MY_BLOCK_SIZE) / MY_BLOCK_SIZE - 1;
+/**
+ * @brief Unlocks one of the mutexes of the shared structures
+ * @param mutex Pointer to the mutex
+ */
+static void unlock_mutex(pthread_mutex_t* mutex) {
+  pthread_mutex_unlock(mutex);
 }
 
-void remove_file(struct my_fcb* file_fcb) {
-  // read the index block for the file
-  struct my_index index_block;
-  read_db_object(file_fcb->data, &index_block, sizeof(index_block));
+/**
+ * @brief Calculates a hash of a UUID
+ * @param id UUID
+ * @return Hash of the UUID
+ */
+static unsigned int get_id_hash(uuid_t id) {
+  // UUIDs are random, so their first bytes are good enough as a hash
+  unsigned int hash;
+  memcpy(&hash, id, sizeof(hash));
+  return hash;
+}
 
-  // get the number of data blocks used by the file data
-  int num_blocks = get_num_blocks(file_fcb->size);
+/**
+ * @brief Finds the link pointing to the lock of a FCB in its hash bucket
+ * @param id UUID of the FCB
+ * @return Pointer to the link, it points to NULL if the FCB has no lock
+ */
+static struct my_fcb_lock** find_fcb_lock(uuid_t id) {
+  struct my_fcb_lock** link = &(fcb_locks[get_id_hash(id) % MY_FCB_LOCK_BUCKETS]);
 
-  // delete all data blocks
-  for (int block = 0; block < num_blocks; block++) {
-    delete_db_object(index_block.entries[block]);
+  while (*link != NULL && uuid_compare((*link)->id, id) != 0) {
+    link = &((*link)->next);
   }
 
-  // delete the index block and FCB
-  delete_db_object(file_fcb->data);
-  delete_db_object(file_fcb->id);
+  return link;
 }
 
-void truncate_file(struct my_fcb* file_fcb, size_t size) {
-  // read the index block for the file
-  struct my_index index_block;
-  read_db_object(file_fcb->data, &index_block, sizeof(index_block));
-
-  /** @var Number of data blocks currently used by the file */
-  int old_num_blocks = get_num_blocks(file_fcb->size);
+void lock_fcb(uuid_t id, char write) {
+  lock_mutex(&fcb_locks_lock);
 
-  /** @var Number of data blocks the file needs to have */
-  int new_num_blocks = get_num_blocks(size);
+  struct my_fcb_lock* fcb_lock = *find_fcb_lock(id);
 
-  if (new_num_blocks > old_num_blocks) {
-    // we need to create some blocks at the end of the file
+  // the lock is created when the first thread needs it
+  if (fcb_lock == NULL) {
+    fcb_lock = malloc(sizeof(struct my_fcb_lock));
+    uuid_copy(fcb_lock->id, id);
+    pthread_rwlock_init(&(fcb_lock->lock), NULL);
+    fcb_lock->refs = 0;
+    fcb_lock->next = NULL;
+    *find_fcb_lock(id) = fcb_lock;
+  }
 
-    /** @var Pointer to a data block filled with zeroes */
-    void* empty_block = calloc(1, MY_BLOCK_SIZE);
+  // the reference keeps the lock allocated while this thread waits for it
+  fcb_lock->refs++;
+  unlock_mutex(&fcb_locks_lock);
 
-    // go through all data blocks we need to create
-    for (int block = old_num_blocks; block < new_num_blocks; block++) {
-      // create UUID for the data block and write an empty data block into the database
-      uuid_generate(index_block.entries[block]);
-      write_db_object(index_block.entries[block], empty_block, MY_BLOCK_SIZE);
-    }
+  if (write) {
+    pthread_rwlock_wrlock(&(fcb_lock->lock));
+  } else {
+    pthread_rwlock_rdlock(&(fcb_lock->lock));
+  }
+}
 
-    free(empty_block);
+void unlock_fcb(uuid_t id) {
+  lock_mutex(&fcb_locks_lock);
 
-    // save changes made in the index block to the database
-    write_db_object(file_fcb->data, &index_block, sizeof(index_block));
+  struct my_fcb_lock** link = find_fcb_lock(id);
+  struct my_fcb_lock* fcb_lock = *link;
 
-  } else if (new_num_blocks < old_num_blocks) {
-    // we need to remove some blocks at the end of the file
+  if (fcb_lock != NULL) {
+    pthread_rwlock_unlock(&(fcb_lock->lock));
 
-    // go through all data blocks that need to be removed
-    for (int block = new_num_blocks; block < old_num_blocks; block++) {
-      delete_db_object(index_block.entries[block]);
+    // the lock is deleted when no other thread holds or waits for it
+    if (--fcb_lock->refs == 0) {
+      *link = fcb_lock->next;
+      pthread_rwlock_destroy(&(fcb_lock->lock));
+      free(fcb_lock);
     }
   }
 
-  // finally update file size and modification time
-  file_fcb->size = size;
-  file_fcb->mtime = time(0);
-  update_file(file_fcb);
+  unlock_mutex(&fcb_locks_lock);
 }
 
-void read_block_to_buffer(uuid_t id, int block_num, void* buffer, size_t size, off_t offset) {
-  // read the data from the data block into memory
-  void* block_data = malloc(MY_BLOCK_SIZE);
-  read_db_object(id, block_data, MY_BLOCK_SIZE);
+void read_db_object(uuid_t key, void* buffer, size_t size) {
+  // separate variable for size is required because unqlite will store
+  // the read size in it
+  unqlite_int64 unqlite_size = size;
 
-  /** @var Offset in the file of the first byte of the block */
-  off_t block_start = block_num * MY_BLOCK_SIZE;
-  /** @var Offset in the file of the last byte of the block */
-  off_t block_end = block_start + MY_BLOCK_SIZE - 1;
+  // the database handle is shared by all threads
+  lock_mutex(&db_lock);
+  int rc = unqlite_kv_fetch(pDb, key, KEY_SIZE, buffer, &unqlite_size);
+  unlock_mutex(&db_lock);
 
-  /** @var Offset in the file of the first byte of the read data */
-  off_t data_start = offset;
-  /** @var Offset in the file of the last byte of the read data */
-  off_t data_end = offset + size - 1;
+  error_handler(rc);
+}
 
-  // requested data range is fully contained in the block
-  if (block_start <= data_start && block_end >= data_end) {
-    // copy a slice of the data block into the buffer
-    memcpy(buffer, block_data + (data_start - block_start), size);
-  }
+/** @brief State of a fetch copying a range of an object into a buffer */
+struct my_range_fetch {
+  void* buffer; /**< Buffer for the range */
+  size_t start; /**< Offset in the object of the first byte of the range */
+  size_t end; /**< Offset in the object after the last byte of the range */
+  size_t position; /**< Offset in the object of the next fetched chunk */
+};
 
-  // requested data range starts in the block, but ends outside it
-  if (block_start <= data_start && block_end < data_end) {
-    // copy the data from data start until the block end to the buffer
-    memcpy(buffer, block_data + (data_start - block_start), block_end - data_start + 1);
-  }
+/**
+ * @brief Copies the part of a fetched chunk that is in the range into the buffer
+ *
+ * UnQLite calls this with consecutive chunks of the object, directly from its
+ * pages, so no copy of the whole object is ever made.
+ *
+ * @param data Chunk of the object data
+ * @param length Length of the chunk
+ * @param user_data Pointer to the fetch state
+ * @return UNQLITE_OK
+ */
+static int fetch_range_consumer(const void* data, unsigned int length, void* user_data) {
+  struct my_range_fetch* fetch = user_data;
 
-  // request data range ends in the block, but starts outside it
-  if (block_start > data_start && block_end >= data_end) {
-    // copy the data from block start until the data end to the buffer
-    memcpy(buffer + (block_start - data_start), block_data, data_end - block_start + 1);
-  }
+  size_t chunk_start = fetch->position;
+  size_t chunk_end = chunk_start + length;
+  fetch->position = chunk_end;
 
-  // requested data range starts and ends outside the block
-  if (block_start > data_start && block_end < data_end) {
-    // copy the whole data block to the buffer
-    memcpy(buffer + (block_start - data_start), block_data, MY_BLOCK_SIZE);
+  // overlap of the chunk and the range
+  size_t copy_start = (chunk_start > fetch->start) ? chunk_start : fetch->start;
+  size_t copy_end = (chunk_end < fetch->end) ? chunk_end : fetch->end;
+
+  if (copy_start < copy_end) {
+    memcpy(fetch->buffer + (copy_start - fetch->start), data + (copy_start - chunk_start), copy_end - copy_start);
   }
 
-  free(block_data);
+  return UNQLITE_OK;
 }
 
-void read_file_data(struct my_fcb* file_fcb, void* buffer, size_t size, off_t offset) {
-  // read the index block from the database
-  struct my_index index_block;
-  read_db_object(file_fcb->data, &index_block, sizeof(index_block));
+char fetch_db_object_chunks(uuid_t key, int (*consumer)(const void*, unsigned int, void*), void* user_data) {
+  // the consumer is called with the database locked, the chunks point into its pages
+  lock_mutex(&db_lock);
+  int rc = unqlite_kv_fetch_callback(pDb, key, KEY_SIZE, consumer, user_data);
+  unlock_mutex(&db_lock);
 
-  // get the indexes of the first and last data block needed for reading
-  int first_block, last_block;
-  get_block_indexes(size, offset, &first_block, &last_block);
+  if (rc == UNQLITE_NOTFOUND) {
+    return 0;
+  }
+
+  error_handler(rc);
+  return 1;
+}
+
+long fetch_db_object(uuid_t key, void* buffer, size_t size) {
+  // the whole object is passed through the consumer, so its position ends up
+  // being the stored size even if only a part of it fits in the buffer
+  struct my_range_fetch fetch = {buffer, 0, size, 0};
+
+  if (!fetch_db_object_chunks(key, fetch_range_consumer, &fetch)) {
+    return -1;
+  }
+
+  return fetch.position;
+}
+
+void read_db_object_range(uuid_t key, void* buffer, size_t size, off_t offset) {
+  struct my_range_fetch fetch = {buffer, offset, offset + size, 0};
+
+  if (!fetch_db_object_chunks(key, fetch_range_consumer, &fetch)) {
+    error_handler(UNQLITE_NOTFOUND);
+  }
+}
+
+void write_db_object(uuid_t key, void* buffer, size_t size) {
+  lock_mutex(&db_lock);
+  int rc = unqlite_kv_store(pDb, key, KEY_SIZE, buffer, size);
+  unlock_mutex(&db_lock);
+
+  error_handler(rc);
+}
+
+void delete_db_object(uuid_t key) {
+  lock_mutex(&db_lock);
+  int rc = unqlite_kv_delete(pDb, key, KEY_SIZE);
+  unlock_mutex(&db_lock);
+
+  error_handler(rc);
+}
+
+char has_db_object(uuid_t key) {
+  // without a consumer the object is only looked up, not read
+  return fetch_db_object_chunks(key, NULL, NULL);
+}
+
+void change_usage(long long blocks, long long files) {
+  // the root object is shared with the commit, which writes it
+  lock_mutex(&db_lock);
+  root_object.blocks += blocks;
+  root_object.files += files;
+  usage_changed = 1;
+  unlock_mutex(&db_lock);
+}
+
+void get_usage_stat(struct statvfs* stbuf) {
+  lock_mutex(&db_lock);
+  long long blocks = root_object.blocks;
+  long long files = root_object.files;
+  unlock_mutex(&db_lock);
+
+  // databases created before the counters existed start counting from zero
+  if (blocks < 0) blocks = 0;
+  if (files < 0) files = 0;
+
+  // free space left for the database, every new file needs at least its FCB
+  struct statvfs store_stat;
+  fsblkcnt_t free_blocks = 0;
+  fsfilcnt_t free_files = 0;
+
+  if (store_dir >= 0 && fstatvfs(store_dir, &store_stat) == 0) {
+    unsigned long long free_bytes = (unsigned long long) store_stat.f_bavail * store_stat.f_frsize;
+    free_blocks = free_bytes / MY_BLOCK_SIZE;
+    free_files = free_bytes / sizeof(struct my_fcb);
+  }
+
+  memset(stbuf, 0, sizeof(struct statvfs));
+  stbuf->f_bsize = MY_BLOCK_SIZE;
+  stbuf->f_frsize = MY_BLOCK_SIZE;
+  stbuf->f_blocks = blocks + free_blocks;
+  stbuf->f_bfree = free_blocks;
+  stbuf->f_bavail = free_blocks;
+  stbuf->f_files = files + free_files;
+  stbuf->f_ffree = free_files;
+  stbuf->f_favail = free_files;
+  stbuf->f_namemax = MY_MAX_PATH - 1;
+}
+
+/**
+ * @brief Commits the finished operations to the database
+ *
+ * The caller must hold group_commit.lock and no operation can be in progress.
+ */
+static void commit_group() {
+  lock_mutex(&db_lock);
+
+  // the usage counters are committed together with the operations which changed them
+  int rc = usage_changed ? write_root() : UNQLITE_OK;
+  usage_changed = 0;
+
+  if (rc == UNQLITE_OK) {
+    rc = unqlite_commit(pDb);
+  }
+
+  unlock_mutex(&db_lock);
+
+  error_handler(rc);
+
+  group_commit.commits++;
+  group_commit.pending = 0;
+  group_commit.wanted = 0;
+
+  // wake up the operations waiting for the commit
+  pthread_cond_broadcast(&(group_commit.changed));
+}
+
+void init_group_commit(int max_ops, int interval) {
+  group_commit.max_ops = (max_ops > 1) ? max_ops : 1;
+  group_commit.interval = (interval > 0) ? interval : 0;
+  group_commit.active = 0;
+  group_commit.pending = 0;
+  group_commit.first_pending = 0;
+  group_commit.wanted = 0;
+  group_commit.running = 0;
+  group_commit.commits = 0;
+
+  pthread_mutex_init(&(group_commit.lock), NULL);
+  pthread_cond_init(&(group_commit.changed), NULL);
+}
+
+void begin_db_operation() {
+  pthread_mutex_lock(&(group_commit.lock));
+
+  // new operations wait, so that the ones in progress can finish and be committed
+  while (group_commit.wanted) {
+    pthread_cond_wait(&(group_commit.changed), &(group_commit.lock));
+  }
+
+  group_commit.active++;
+
+  pthread_mutex_unlock(&(group_commit.lock));
+}
+
+void end_db_operation() {
+  pthread_mutex_lock(&(group_commit.lock));
+
+  group_commit.active--;
+
+  if (group_commit.pending++ == 0) {
+    group_commit.first_pending = time(NULL);
+  }
+
+  if (group_commit.pending >= group_commit.max_ops) {
+    group_commit.wanted = 1;
+  }
+
+  if (group_commit.wanted && group_commit.active == 0) {
+    // this is the last operation of the group
+    commit_group();
+  } else {
+    // the commit thread or commit_db may be waiting for this operation
+    pthread_cond_broadcast(&(group_commit.changed));
+  }
+
+  pthread_mutex_unlock(&(group_commit.lock));
+}
+
+void sync_db() {
+  pthread_mutex_lock(&(group_commit.lock));
+
+  // a finished operation is pending until it is committed
+  if (group_commit.pending > 0) {
+    unsigned long commit = group_commit.commits + 1;
+    group_commit.wanted = 1;
+
+    if (group_commit.active == 0) {
+      commit_group();
+    }
+
+    // otherwise the last operation in progress makes the commit
+    while (group_commit.commits < commit) {
+      pthread_cond_wait(&(group_commit.changed), &(group_commit.lock));
+    }
+  }
+
+  pthread_mutex_unlock(&(group_commit.lock));
+}
+
+/**
+ * @brief Returns the number of commits after which the changes made so far are durable
+ * @return Number of commits made, plus one if some operation is not committed yet
+ */
+static unsigned long get_change_commit() {
+  pthread_mutex_lock(&(group_commit.lock));
+
+  unsigned long commit = group_commit.commits;
+
+  // the operations in progress and the finished ones go in the next commit
+  if (group_commit.active > 0 || group_commit.pending > 0) {
+    commit++;
+  }
+
+  pthread_mutex_unlock(&(group_commit.lock));
+  return commit;
+}
+
+void commit_db() {
+  pthread_mutex_lock(&(group_commit.lock));
+
+  // keep new operations from starting until the commit is made
+  group_commit.wanted = 1;
+
+  while (group_commit.active > 0) {
+    pthread_cond_wait(&(group_commit.changed), &(group_commit.lock));
+  }
+
+  // changes made outside of operations are committed too
+  commit_group();
+
+  pthread_mutex_unlock(&(group_commit.lock));
+}
+
+/**
+ * @brief Commits the finished operations when the oldest of them has waited for the interval
+ * @param arg Not used
+ * @return NULL
+ */
+static void* run_commit_thread(void* arg) {
+  (void)arg;
+
+  pthread_mutex_lock(&(group_commit.lock));
+
+  while (group_commit.running) {
+    time_t deadline = group_commit.first_pending + group_commit.interval;
+
+    if (group_commit.pending > 0 && !group_commit.wanted && time(NULL) >= deadline) {
+      if (group_commit.active == 0) {
+        commit_group();
+      } else {
+        // the last operation in progress makes the commit
+        group_commit.wanted = 1;
+      }
+    }
+
+    if (group_commit.pending > 0 && !group_commit.wanted) {
+      // sleep until the oldest operation has waited for the interval
+      struct timespec timeout = {.tv_sec = deadline, .tv_nsec = 0};
+      pthread_cond_timedwait(&(group_commit.changed), &(group_commit.lock), &timeout);
+    } else {
+      // nothing to do until an operation finishes or a commit is made
+      pthread_cond_wait(&(group_commit.changed), &(group_commit.lock));
+    }
+  }
+
+  pthread_mutex_unlock(&(group_commit.lock));
+
+  return NULL;
+}
+
+void start_commit_thread() {
+  // without an interval the operations are committed only by their number
+  if (group_commit.interval == 0) return;
+
+  group_commit.running = 1;
+
+  if (pthread_create(&(group_commit.thread), NULL, run_commit_thread, NULL) != 0) {
+    group_commit.running = 0;
+  }
+}
+
+void stop_commit_thread() {
+  if (!group_commit.running) return;
+
+  pthread_mutex_lock(&(group_commit.lock));
+  group_commit.running = 0;
+  pthread_cond_broadcast(&(group_commit.changed));
+  pthread_mutex_unlock(&(group_commit.lock));
+
+  pthread_join(group_commit.thread, NULL);
+}
+
+/**
+ * @brief Calculates a hash of a file name
+ * @param name File name
+ * @return FNV-1a hash of the name
+ */
+static unsigned int get_name_hash(const char* name) {
+  unsigned int hash = 2166136261u;
+
+  for (const char* c = name; *c != '\0'; c++) {
+    hash ^= (unsigned char) *c;
+    hash *= 16777619u;
+  }
+
+  return hash;
+}
+
+/**
+ * @brief Removes a cached entry from the LRU list of its cache
+ * @param cache Pointer to the cache
+ * @param entry Pointer to the entry
+ */
+static void unlink_cache_entry(struct my_cache* cache, struct my_cache_entry* entry) {
+  if (entry->lru_prev != NULL) {
+    entry->lru_prev->lru_next = entry->lru_next;
+  } else {
+    cache->lru_first = entry->lru_next;
+  }
+
+  if (entry->lru_next != NULL) {
+    entry->lru_next->lru_prev = entry->lru_prev;
+  } else {
+    cache->lru_last = entry->lru_prev;
+  }
+}
+
+/**
+ * @brief Adds a cached entry to the start of the LRU list of its cache
+ * @param cache Pointer to the cache
+ * @param entry Pointer to the entry
+ */
+static void link_cache_entry(struct my_cache* cache, struct my_cache_entry* entry) {
+  entry->lru_prev = NULL;
+  entry->lru_next = cache->lru_first;
+
+  if (cache->lru_first != NULL) {
+    cache->lru_first->lru_prev = entry;
+  } else {
+    cache->lru_last = entry;
+  }
+
+  cache->lru_first = entry;
+}
+
+void init_cache(struct my_cache* cache, int capacity) {
+  cache->capacity = capacity;
+  cache->size = 0;
+  cache->buckets = (capacity > 0) ? calloc(capacity, sizeof(struct my_cache_entry*)) : NULL;
+  cache->lru_first = NULL;
+  cache->lru_last = NULL;
+  cache->hits = 0;
+  cache->misses = 0;
+}
+
+struct my_cache_entry* find_cache_entry(struct my_cache* cache, unsigned int hash, char (*match)(struct my_cache_entry*, const void*), const void* key) {
+  struct my_cache_entry* entry = cache->buckets[hash % cache->capacity];
+
+  while (entry != NULL && (entry->hash != hash || !match(entry, key))) {
+    entry = entry->hash_next;
+  }
+
+  return entry;
+}
+
+struct my_cache_entry* lookup_cache_entry(struct my_cache* cache, unsigned int hash, char (*match)(struct my_cache_entry*, const void*), const void* key) {
+  struct my_cache_entry* entry = find_cache_entry(cache, hash, match, key);
+
+  if (entry == NULL) {
+    cache->misses++;
+    return NULL;
+  }
+
+  cache->hits++;
+  touch_cache_entry(cache, entry);
+  return entry;
+}
+
+void add_cache_entry(struct my_cache* cache, struct my_cache_entry* entry, unsigned int hash) {
+  struct my_cache_entry** bucket = &(cache->buckets[hash % cache->capacity]);
+
+  entry->hash = hash;
+  entry->hash_next = *bucket;
+  *bucket = entry;
+
+  link_cache_entry(cache, entry);
+  cache->size++;
+}
+
+void touch_cache_entry(struct my_cache* cache, struct my_cache_entry* entry) {
+  unlink_cache_entry(cache, entry);
+  link_cache_entry(cache, entry);
+}
+
+void remove_cache_entry(struct my_cache* cache, struct my_cache_entry* entry) {
+  struct my_cache_entry** link = &(cache->buckets[entry->hash % cache->capacity]);
+
+  while (*link != entry) {
+    link = &((*link)->hash_next);
+  }
+
+  *link = entry->hash_next;
+  unlink_cache_entry(cache, entry);
+  cache->size--;
+}
+
+void clean_cache(struct my_cache* cache) {
+  struct my_cache_entry* entry = cache->lru_first;
+
+  while (entry != NULL) {
+    struct my_cache_entry* next = entry->lru_next;
+    free(entry);
+    entry = next;
+  }
+
+  free(cache->buckets);
+  init_cache(cache, 0);
+}
+
+/**
+ * @brief Tells whether a cached block has the UUID
+ * @param entry Pointer to the cached block
+ * @param key UUID of the data block
+ * @return 1 if the UUIDs are the same, 0 otherwise
+ */
+static char match_cached_block(struct my_cache_entry* entry, const void* key) {
+  return uuid_compare(((struct my_cached_block*) entry)->id, key) == 0;
+}
+
+/**
+ * @brief Finds a cached block without changing the LRU list
+ * @param id UUID of the data block
+ * @return Pointer to the cached block, or NULL if the block is not cached
+ */
+static struct my_cached_block* find_cached_block(uuid_t id) {
+  return (struct my_cached_block*) find_cache_entry(&block_cache, get_id_hash(id), match_cached_block, id);
+}
+
+void init_block_cache(int capacity) {
+  init_cache(&block_cache, capacity);
+}
+
+void* get_cached_block(uuid_t id) {
+  if (block_cache.capacity == 0) return NULL;
+
+  lock_mutex(&block_cache_lock);
+  struct my_cached_block* block = (struct my_cached_block*) lookup_cache_entry(&block_cache, get_id_hash(id), match_cached_block, id);
+  unlock_mutex(&block_cache_lock);
+
+  return (block != NULL) ? block->data : NULL;
+}
+
+void* add_cached_block(uuid_t id) {
+  if (block_cache.capacity == 0) return NULL;
+
+  lock_mutex(&block_cache_lock);
+
+  struct my_cached_block* block = find_cached_block(id);
+
+  if (block != NULL) {
+    // the block is already cached, just move it to the start of the LRU list
+    touch_cache_entry(&block_cache, &(block->entry));
+    unlock_mutex(&block_cache_lock);
+    return block->data;
+  }
+
+  if (block_cache.size < block_cache.capacity) {
+    // there is still space in the cache, allocate a new block
+    block = malloc(sizeof(struct my_cached_block));
+  } else {
+    // the cache is full, reuse the least recently used block
+    block = (struct my_cached_block*) block_cache.lru_last;
+    remove_cache_entry(&block_cache, &(block->entry));
+  }
+
+  uuid_copy(block->id, id);
+  add_cache_entry(&block_cache, &(block->entry), get_id_hash(id));
+
+  unlock_mutex(&block_cache_lock);
+  return block->data;
+}
+
+void remove_cached_block(uuid_t id) {
+  if (block_cache.capacity == 0) return;
+
+  lock_mutex(&block_cache_lock);
+
+  struct my_cached_block* block = find_cached_block(id);
+
+  if (block != NULL) {
+    remove_cache_entry(&block_cache, &(block->entry));
+    free(block);
+  }
+
+  // a copy of the block being read at the same time must not be cached
+  block_changes++;
+
+  unlock_mutex(&block_cache_lock);
+}
+
+/**
+ * @brief Adds a data block read from the database to the block cache
+ *
+ * The block is not cached if any data block was written or removed since the
+ * read started, it could have been read before the change.
+ *
+ * @param id UUID of the data block
+ * @param data Block data
+ * @param changes Value of block_changes before the read started
+ */
+static void cache_read_block(uuid_t id, void* data, unsigned long changes) {
+  lock_mutex(&block_cache_lock);
+
+  if (block_changes == changes) {
+    memcpy(add_cached_block(id), data, MY_BLOCK_SIZE);
+  }
+
+  unlock_mutex(&block_cache_lock);
+}
+
+/**
+ * @brief Updates the cached copy of a data block after it was written to the database
+ * @param id UUID of the data block
+ * @param data New block data
+ * @param add Boolean, whether to add the block if it is not cached
+ */
+static void update_cached_block(uuid_t id, void* data, char add) {
+  if (block_cache.capacity == 0) return;
+
+  lock_mutex(&block_cache_lock);
+
+  struct my_cached_block* block = find_cached_block(id);
+  void* block_data = (block != NULL) ? block->data : (add ? add_cached_block(id) : NULL);
+
+  if (block_data != NULL) {
+    memcpy(block_data, data, MY_BLOCK_SIZE);
+  }
+
+  // a copy of the block being read at the same time must not be cached
+  block_changes++;
+
+  unlock_mutex(&block_cache_lock);
+}
+
+void clean_block_cache() {
+  clean_cache(&block_cache);
+}
+
+/**
+ * @brief Tells whether a cached FCB has the UUID
+ * @param entry Pointer to the cached FCB
+ * @param key UUID of the FCB
+ * @return 1 if the UUIDs are the same, 0 otherwise
+ */
+static char match_cached_fcb(struct my_cache_entry* entry, const void* key) {
+  return uuid_compare(((struct my_cached_fcb*) entry)->fcb.id, key) == 0;
+}
+
+/**
+ * @brief Finds a cached FCB without changing the LRU list
+ * @param id UUID of the FCB
+ * @return Pointer to the cached FCB, or NULL if the FCB is not cached
+ */
+static struct my_cached_fcb* find_cached_fcb(uuid_t id) {
+  return (struct my_cached_fcb*) find_cache_entry(&fcb_cache, get_id_hash(id), match_cached_fcb, id);
+}
+
+/**
+ * @brief Evicts the least recently used unreferenced FCBs until the FCB cache is within capacity
+ * @param keep Number of FCBs to make space for
+ */
+static void evict_cached_fcbs(int keep) {
+  struct my_cache_entry* entry = fcb_cache.lru_last;
+
+  while (entry != NULL && fcb_cache.size + keep > fcb_cache.capacity) {
+    struct my_cache_entry* prev = entry->lru_prev;
+
+    if (((struct my_cached_fcb*) entry)->refs == 0) {
+      remove_cache_entry(&fcb_cache, entry);
+      free(entry);
+    }
+
+    entry = prev;
+  }
+}
+
+void init_fcb_cache(int capacity) {
+  init_cache(&fcb_cache, capacity);
+}
+
+struct my_fcb* get_cached_fcb(uuid_t id) {
+  if (fcb_cache.capacity == 0) return NULL;
+
+  lock_mutex(&fcb_cache_lock);
+  struct my_cached_fcb* cached = (struct my_cached_fcb*) lookup_cache_entry(&fcb_cache, get_id_hash(id), match_cached_fcb, id);
+  unlock_mutex(&fcb_cache_lock);
+
+  return (cached != NULL) ? &(cached->fcb) : NULL;
+}
+
+void add_cached_fcb(struct my_fcb* file_fcb) {
+  if (fcb_cache.capacity == 0) return;
+
+  lock_mutex(&fcb_cache_lock);
+
+  struct my_cached_fcb* cached = find_cached_fcb(file_fcb->id);
+
+  if (cached != NULL) {
+    // the FCB is already cached, the copy is replaced below
+    touch_cache_entry(&fcb_cache, &(cached->entry));
+
+  } else {
+    // make space by evicting unreferenced FCBs, if all of them are
+    // referenced the cache grows over capacity
+    evict_cached_fcbs(1);
+
+    cached = malloc(sizeof(struct my_cached_fcb));
+    cached->refs = 0;
+    uuid_copy(cached->fcb.id, file_fcb->id);
+    add_cache_entry(&fcb_cache, &(cached->entry), get_id_hash(file_fcb->id));
+  }
+
+  // only the part of the FCB which is stored in the database is valid
+  memcpy(&(cached->fcb), file_fcb, get_fcb_record_size(file_fcb));
+
+  unlock_mutex(&fcb_cache_lock);
+}
+
+void remove_cached_fcb(uuid_t id) {
+  if (fcb_cache.capacity == 0) return;
+
+  lock_mutex(&fcb_cache_lock);
+
+  struct my_cached_fcb* cached = find_cached_fcb(id);
+
+  if (cached != NULL) {
+    remove_cache_entry(&fcb_cache, &(cached->entry));
+    free(cached);
+  }
+
+  unlock_mutex(&fcb_cache_lock);
+}
+
+void hold_cached_fcb(struct my_fcb* file_fcb) {
+  if (fcb_cache.capacity == 0) return;
+
+  lock_mutex(&fcb_cache_lock);
+
+  if (find_cached_fcb(file_fcb->id) == NULL) {
+    add_cached_fcb(file_fcb);
+  }
+
+  find_cached_fcb(file_fcb->id)->refs++;
+
+  unlock_mutex(&fcb_cache_lock);
+}
+
+void release_cached_fcb(uuid_t id) {
+  if (fcb_cache.capacity == 0) return;
+
+  lock_mutex(&fcb_cache_lock);
+
+  struct my_cached_fcb* cached = find_cached_fcb(id);
+
+  if (cached != NULL && cached->refs > 0) {
+    cached->refs--;
+
+    // the cache grew over capacity while all FCBs were referenced
+    if (cached->refs == 0 && fcb_cache.size > fcb_cache.capacity) {
+      evict_cached_fcbs(0);
+    }
+  }
+
+  unlock_mutex(&fcb_cache_lock);
+}
+
+void clean_fcb_cache() {
+  clean_cache(&fcb_cache);
+}
+
+/**
+ * @brief Calculates a hash of a name in a directory
+ * @param key Pointer to the directory UUID and the name
+ * @return Hash of the dentry key
+ */
+static unsigned int get_dentry_hash(const struct my_dentry_key* key) {
+  // combine the hash of the random UUID with the name hash
+  return get_id_hash(key->dir_id) ^ get_name_hash(key->name);
+}
+
+/**
+ * @brief Tells whether a cached dentry is for the name in the directory
+ * @param entry Pointer to the cached dentry
+ * @param key Pointer to the dentry key
+ * @return 1 if the directory and the name are the same, 0 otherwise
+ */
+static char match_cached_dentry(struct my_cache_entry* entry, const void* key) {
+  struct my_dentry* dentry = (struct my_dentry*) entry;
+  const struct my_dentry_key* dentry_key = key;
+
+  return uuid_compare(dentry->dir_id, dentry_key->dir_id) == 0 && strcmp(dentry->name, dentry_key->name) == 0;
+}
+
+void init_dentry_cache(int capacity) {
+  init_cache(&dentry_cache, capacity);
+}
+
+char get_cached_dentry(uuid_t dir_id, const char* name, uuid_t fcb_id) {
+  if (dentry_cache.capacity == 0) return 0;
+
+  struct my_dentry_key key = {dir_id, name};
+
+  lock_mutex(&dentry_cache_lock);
+
+  struct my_dentry* dentry = (struct my_dentry*) lookup_cache_entry(&dentry_cache, get_dentry_hash(&key), match_cached_dentry, &key);
+
+  if (dentry != NULL) {
+    uuid_copy(fcb_id, dentry->fcb_id);
+  }
+
+  unlock_mutex(&dentry_cache_lock);
+  return dentry != NULL;
+}
+
+void add_cached_dentry(uuid_t dir_id, const char* name, uuid_t fcb_id) {
+  // names which do not fit in a directory entry are never found anyway
+  if (dentry_cache.capacity == 0 || strlen(name) >= MY_MAX_PATH) return;
+
+  struct my_dentry_key key = {dir_id, name};
+  unsigned int hash = get_dentry_hash(&key);
+
+  lock_mutex(&dentry_cache_lock);
+
+  struct my_dentry* dentry = (struct my_dentry*) find_cache_entry(&dentry_cache, hash, match_cached_dentry, &key);
+
+  if (dentry != NULL) {
+    // the dentry is already cached, just move it to the start of the LRU list
+    touch_cache_entry(&dentry_cache, &(dentry->entry));
+
+  } else {
+    if (dentry_cache.size < dentry_cache.capacity) {
+      // there is still space in the cache, allocate a new dentry
+      dentry = malloc(sizeof(struct my_dentry));
+    } else {
+      // the cache is full, reuse the least recently used dentry
+      dentry = (struct my_dentry*) dentry_cache.lru_last;
+      remove_cache_entry(&dentry_cache, &(dentry->entry));
+    }
+
+    uuid_copy(dentry->dir_id, dir_id);
+    strcpy(dentry->name, name);
+    add_cache_entry(&dentry_cache, &(dentry->entry), hash);
+  }
+
+  uuid_copy(dentry->fcb_id, fcb_id);
+
+  unlock_mutex(&dentry_cache_lock);
+}
+
+void clean_dentry_cache() {
+  clean_cache(&dentry_cache);
+}
+
+/**
+ * @brief Finds the inode of a FCB in its hash bucket
+ * @param id UUID of the FCB
+ * @return Index of the inode, -1 if the FCB has no inode
+ */
+static int find_inode(uuid_t id) {
+  int index = inode_table.buckets[get_id_hash(id) % inode_table.capacity];
+
+  while (index > -1 && uuid_compare(inode_table.inodes[index].id, id) != 0) {
+    index = inode_table.inodes[index].next;
+  }
+
+  return index;
+}
+
+/**
+ * @brief Adds a used inode to its hash bucket
+ * @param index Index of the inode
+ */
+static void link_inode(int index) {
+  int* bucket = &(inode_table.buckets[get_id_hash(inode_table.inodes[index].id) % inode_table.capacity]);
+  inode_table.inodes[index].next = *bucket;
+  *bucket = index;
+}
+
+/**
+ * @brief Doubles the number of inodes, the new ones are added to the free list
+ *
+ * Inodes stay at the same indexes so their numbers do not change, only the
+ * hash table is rebuilt for the new capacity.
+ */
+static void grow_inode_table() {
+  int old_capacity = inode_table.capacity;
+  int capacity = (old_capacity > 0) ? old_capacity * 2 : MY_MIN_INODES;
+
+  inode_table.inodes = realloc(inode_table.inodes, capacity * sizeof(struct my_inode));
+  inode_table.buckets = realloc(inode_table.buckets, capacity * sizeof(int));
+  inode_table.capacity = capacity;
+
+  // new inodes are free, the lowest index is the first one taken
+  for (int i = capacity - 1; i >= old_capacity; i--) {
+    uuid_clear(inode_table.inodes[i].id);
+    inode_table.inodes[i].lookups = 0;
+    inode_table.inodes[i].generation = 0;
+    inode_table.inodes[i].data_commit = 0;
+    inode_table.inodes[i].next = inode_table.free;
+    inode_table.free = i;
+  }
+
+  for (int i = 0; i < capacity; i++) {
+    inode_table.buckets[i] = -1;
+  }
+
+  for (int i = 0; i < old_capacity; i++) {
+    if (!uuid_is_null(inode_table.inodes[i].id)) link_inode(i);
+  }
+}
+
+void init_inode_table(uuid_t root_id) {
+  inode_table.capacity = 0;
+  inode_table.inodes = NULL;
+  inode_table.buckets = NULL;
+  inode_table.free = -1;
+
+  grow_inode_table();
+
+  // the first free inode is the one with number 1, the kernel uses it for the
+  // root directory and never looks the root up
+  add_inode_lookup(root_id);
+}
+
+unsigned long add_inode_lookup(uuid_t id) {
+  // the data of a file unknown until now may have been changed by any
+  // operation which is not committed yet
+  unsigned long data_commit = get_change_commit();
+
+  lock_mutex(&inode_table_lock);
+
+  int index = find_inode(id);
+
+  if (index < 0) {
+    if (inode_table.free < 0) grow_inode_table();
+
+    // take the first free inode, a reused number gets a new generation so the
+    // kernel does not mistake the file for the previous one
+    index = inode_table.free;
+    struct my_inode* inode = &(inode_table.inodes[index]);
+    inode_table.free = inode->next;
+
+    uuid_copy(inode->id, id);
+    inode->generation++;
+    inode->data_commit = data_commit;
+    link_inode(index);
+  }
+
+  inode_table.inodes[index].lookups++;
+
+  unlock_mutex(&inode_table_lock);
+  return index + 1;
+}
+
+char get_inode_id(unsigned long ino, uuid_t id) {
+  char found = 0;
+
+  // the inodes move in memory when the table grows
+  lock_mutex(&inode_table_lock);
+
+  if (ino >= 1 && ino <= (unsigned long)inode_table.capacity && !uuid_is_null(inode_table.inodes[ino - 1].id)) {
+    uuid_copy(id, inode_table.inodes[ino - 1].id);
+    found = 1;
+  }
+
+  unlock_mutex(&inode_table_lock);
+  return found;
+}
+
+unsigned long get_inode_generation(unsigned long ino) {
+  unsigned long generation = 0;
+
+  lock_mutex(&inode_table_lock);
+
+  if (ino >= 1 && ino <= (unsigned long)inode_table.capacity) {
+    generation = inode_table.inodes[ino - 1].generation;
+  }
+
+  unlock_mutex(&inode_table_lock);
+  return generation;
+}
+
+void forget_inode(unsigned long ino, unsigned long nlookup) {
+  // the root inode stays for the whole time the file system is mounted
+  if (ino <= 1) return;
+
+  lock_mutex(&inode_table_lock);
+
+  int index = ino - 1;
+
+  if (ino > (unsigned long)inode_table.capacity || uuid_is_null(inode_table.inodes[index].id)) {
+    unlock_mutex(&inode_table_lock);
+    return;
+  }
+
+  struct my_inode* inode = &(inode_table.inodes[index]);
+
+  inode->lookups = (nlookup < inode->lookups) ? inode->lookups - nlookup : 0;
+
+  if (inode->lookups > 0) {
+    unlock_mutex(&inode_table_lock);
+    return;
+  }
+
+  // remove the inode from its hash bucket
+  int* link = &(inode_table.buckets[get_id_hash(inode->id) % inode_table.capacity]);
+
+  while (*link != index) {
+    link = &(inode_table.inodes[*link].next);
+  }
+
+  *link = inode->next;
+
+  // and add it to the free list
+  uuid_clear(inode->id);
+  inode->next = inode_table.free;
+  inode_table.free = index;
+
+  unlock_mutex(&inode_table_lock);
+}
+
+void mark_file_data_changed(uuid_t id) {
+  // the commit is read first, so that the group commit lock is not taken
+  // while holding the inode table lock
+  unsigned long data_commit = get_change_commit();
+
+  lock_mutex(&inode_table_lock);
+
+  int index = find_inode(id);
+
+  if (index > -1) {
+    inode_table.inodes[index].data_commit = data_commit;
+  }
+
+  unlock_mutex(&inode_table_lock);
+}
+
+char is_file_data_synced(uuid_t id) {
+  lock_mutex(&inode_table_lock);
+
+  // a file without an inode is not tracked, it is never taken as synced
+  int index = find_inode(id);
+  unsigned long data_commit = index > -1 ? inode_table.inodes[index].data_commit : ULONG_MAX;
+
+  unlock_mutex(&inode_table_lock);
+
+  pthread_mutex_lock(&(group_commit.lock));
+  char synced = group_commit.commits >= data_commit;
+  pthread_mutex_unlock(&(group_commit.lock));
+
+  return synced;
+}
+
+void clean_inode_table() {
+  free(inode_table.inodes);
+  free(inode_table.buckets);
+
+  inode_table.capacity = 0;
+  inode_table.inodes = NULL;
+  inode_table.buckets = NULL;
+  inode_table.free = -1;
+}
+
+void pin_root_fcb() {
+  lock_mutex(&fcb_cache_lock);
+
+  // read the root from the database, not from the previously pinned copy
+  uuid_clear(root_fcb.id);
+
+  struct my_fcb root_dir;
+
+  if (read_file(&(root_object.id), &root_dir) == 0) {
+    memcpy(&root_fcb, &root_dir, sizeof(struct my_fcb));
+  }
+
+  unlock_mutex(&fcb_cache_lock);
+}
+
+void create_directory(mode_t mode, struct my_user user, struct my_fcb *dir_fcb) {
+  dir_fcb->uid = user.uid;
+  dir_fcb->gid = user.gid;
+  dir_fcb->mode = S_IFDIR|mode;
+  dir_fcb->mtime = time(0);
+  dir_fcb->ctime = time(0);
+  dir_fcb->size = 0;
+  dir_fcb->nlink = 0;
+
+  // create uuid for the FCB
+  uuid_generate(dir_fcb->id);
+  change_usage(0, 1);
+
+  // there are no data blocks yet
+  dir_fcb->num_extents = 0;
+  uuid_clear(dir_fcb->extent_list);
+
+  // create an empty directory header, it is stored in the FCB together with
+  // the rest of the small directory data, so this writes the FCB
+  struct my_dir_header dir_header;
+  for (int list = 0; list < MY_DIR_FREE_LISTS; list++) {
+    dir_header.free_lists[list] = -1;
+  }
+  dir_header.num_entries = 0;
+  uuid_clear(dir_header.index_id);
+  dir_header.index_root = 0;
+  dir_header.index_nodes = 0;
+  dir_header.index_free = -1;
+  write_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+}
+
+void create_file(mode_t mode, struct my_user user, struct my_fcb* file_fcb) {
+  file_fcb->uid = user.uid;
+  file_fcb->gid = user.gid;
+  file_fcb->mode = S_IFREG|mode;
+  file_fcb->mtime = time(0);
+  file_fcb->ctime = time(0);
+  file_fcb->size = 0;
+  file_fcb->nlink = 0;
+
+  // create uuid for the FCB
+  uuid_generate(file_fcb->id);
+  change_usage(0, 1);
+
+  // there are no data blocks yet
+  file_fcb->num_extents = 0;
+  uuid_clear(file_fcb->extent_list);
+
+  // write the FCB to the database
+  update_file(file_fcb);
+}
+
+/**
+ * @brief Derives a UUID from a base UUID by storing a number in its last 4 bytes
+ *
+ * Used for keys of objects belonging together, like data blocks of an extent.
+ *
+ * @param base Base UUID
+ * @param number Number stored in the UUID, e.g. offset of the block in the extent
+ * @param id Derived UUID
+ */
+static void get_derived_id(uuid_t base, int number, uuid_t id) {
+  uuid_copy(id, base);
+
+  // the number is stored big endian, so consecutive numbers give consecutive keys
+  id[12] = (number >> 24) & 0xff;
+  id[13] = (number >> 16) & 0xff;
+  id[14] = (number >> 8) & 0xff;
+  id[15] = number & 0xff;
+}
+
+/**
+ * @brief Finds the last extent in an array which starts at or before the block
+ * @param extents Extents sorted by their first block
+ * @param count Number of extents
+ * @param block Index of the block in the file
+ * @return Index of the extent, or -1 if all extents start after the block
+ */
+static int find_extent_start(struct my_extent* extents, int count, int block) {
+  int low = 0, high = count - 1, found = -1;
+
+  while (low <= high) {
+    int middle = (low + high) / 2;
+
+    if (extents[middle].start <= block) {
+      found = middle;
+      low = middle + 1;
+    } else {
+      high = middle - 1;
+    }
+  }
+
+  return found;
+}
+
+/**
+ * @brief Finds the last extent which starts at or before the block
+ * @param map Pointer to the extent map
+ * @param block Index of the block in the file
+ * @return Index of the extent, or -1 if all extents start after the block
+ */
+static int find_extent(struct my_extent_map* map, int block) {
+  // sequential access usually stays in the last found extent or the next one
+  for (int i = map->last; i <= map->last + 1 && i < map->count; i++) {
+    if (map->extents[i].start <= block
+        && (i + 1 == map->count || map->extents[i + 1].start > block)) {
+      map->last = i;
+      return i;
+    }
+  }
+
+  // otherwise do a binary search
+  int found = find_extent_start(map->extents, map->count, block);
+
+  if (found >= 0) map->last = found;
+  return found;
+}
+
+/**
+ * @brief Deletes data blocks at the end of an extent from the database and the block cache
+ * @param extent Pointer to the extent
+ * @param from Offset in the extent of the first deleted block
+ */
+static void delete_extent_blocks(struct my_extent* extent, int from) {
+  for (int offset = from; offset < extent->length; offset++) {
+    uuid_t block_id;
+    get_derived_id(extent->base, offset, block_id);
+
+    remove_cached_block(block_id);
+    delete_db_object(block_id);
+  }
+
+  change_usage(-(extent->length - from), 0);
+}
+
+/**
+ * @brief Deletes the extents after the new end from a sorted array
+ * @param extents Extents sorted by their first block
+ * @param count Pointer to the number of extents, it is updated
+ * @param num_blocks Number of blocks that remain in the file
+ * @return 1 if the extents were changed, otherwise 0
+ */
+static char truncate_extents(struct my_extent* extents, int* count, int num_blocks) {
+  char changed = 0;
+
+  // extents are sorted, so go from the end until one ends before the new end
+  while (*count > 0) {
+    struct my_extent* extent = &(extents[*count - 1]);
+
+    if (extent->start >= num_blocks) {
+      // the whole extent is after the new end
+      delete_extent_blocks(extent, 0);
+      (*count)--;
+      changed = 1;
+
+    } else {
+      // the extent is cut short if it continues after the new end
+      if (extent->start + extent->length > num_blocks) {
+        delete_extent_blocks(extent, num_blocks - extent->start);
+        extent->length = num_blocks - extent->start;
+        changed = 1;
+      }
+
+      break;
+    }
+  }
+
+  return changed;
+}
+
+/**
+ * @brief Reads a node of an extent tree
+ * @param id UUID of the node
+ * @param node Pointer to a node struct where the node will be stored
+ */
+static void read_extent_node(uuid_t id, struct my_extent_node* node) {
+  // only the used extents are stored
+  read_db_object(id, node, offsetof(struct my_extent_node, extents) + MY_EXTENT_NODE_EXTENTS * sizeof(struct my_extent));
+}
+
+/**
+ * @brief Writes a node of an extent tree
+ * @param id UUID of the node
+ * @param node Pointer to the node
+ */
+static void write_extent_node(uuid_t id, struct my_extent_node* node) {
+  write_db_object(id, node, offsetof(struct my_extent_node, extents) + node->count * sizeof(struct my_extent));
+}
+
+/**
+ * @brief Writes the changed loaded nodes from a level of the tree down and unloads them
+ *
+ * The current leaf is unloaded too, the next lookup loads it again.
+ *
+ * @param map Pointer to the extent map
+ * @param level Level of the first unloaded node, 0 for the root
+ */
+static void unload_extent_nodes(struct my_extent_map* map, int level) {
+  for (int i = level; i < map->depth; i++) {
+    if (map->changed[i]) {
+      write_extent_node(map->ids[i], map->nodes[i]);
+    }
+
+    free(map->nodes[i]);
+  }
+
+  if (map->depth > level) {
+    map->depth = level;
+  }
+
+  map->extents = NULL;
+  map->count = 0;
+  map->last = 0;
+  map->low = map->high = 0;
+}
+
+/**
+ * @brief Loads the leaf of the extent tree with the extents around a block
+ *
+ * Loaded nodes on the path to the leaf are kept, the others are replaced.
+ * Nothing is done if the extents are in the FCB or the current leaf covers
+ * the block.
+ *
+ * @param map Pointer to the extent map
+ * @param block Index of the block in the file
+ */
+static void load_extent_leaf(struct my_extent_map* map, int block) {
+  if (map->total <= MY_FCB_EXTENTS || (map->extents != NULL && block >= map->low && block < map->high)) {
+    return;
+  }
+
+  if (map->depth == 0) {
+    map->nodes[0] = malloc(sizeof(struct my_extent_node));
+    uuid_copy(map->ids[0], map->fcb->extent_list);
+    read_extent_node(map->ids[0], map->nodes[0]);
+    map->changed[0] = 0;
+    map->depth = 1;
+  }
+
+  int low = INT_MIN;
+  int high = INT_MAX;
+  int level = 0;
+
+  // go down the tree, reading only the nodes which are not loaded yet
+  while (!map->nodes[level]->leaf) {
+    struct my_extent_node* node = map->nodes[level];
+
+    // the last child starting at or before the block, blocks before all
+    // extents go to the first one
+    int position = find_extent_start(node->extents, node->count, block);
+    if (position < 0) position = 0;
+
+    if (position > 0) low = node->extents[position].start;
+    if (position + 1 < node->count) high = node->extents[position + 1].start;
+
+    map->positions[level] = position;
+    level++;
+
+    if (level < map->depth && uuid_compare(map->ids[level], node->extents[position].base) == 0) {
+      continue;
+    }
+
+    // another child is needed, the nodes below it are replaced
+    unload_extent_nodes(map, level);
+
+    map->nodes[level] = malloc(sizeof(struct my_extent_node));
+    uuid_copy(map->ids[level], node->extents[position].base);
+    read_extent_node(map->ids[level], map->nodes[level]);
+    map->changed[level] = 0;
+    map->depth = level + 1;
+  }
+
+  map->extents = map->nodes[level]->extents;
+  map->count = map->nodes[level]->count;
+  map->last = 0;
+  map->low = low;
+  map->high = high;
+}
+
+/**
+ * @brief Moves the extents from the FCB to a new extent tree with one leaf
+ * @param map Pointer to the extent map
+ */
+static void create_extent_tree(struct my_extent_map* map) {
+  struct my_extent_node* root = malloc(sizeof(struct my_extent_node));
+  root->leaf = 1;
+  root->count = map->count;
+  memcpy(root->extents, map->extents, map->count * sizeof(struct my_extent));
+
+  uuid_generate(map->fcb->extent_list);
+
+  map->nodes[0] = root;
+  uuid_copy(map->ids[0], map->fcb->extent_list);
+  map->changed[0] = 1;
+  map->depth = 1;
+
+  map->extents = root->extents;
+  map->low = INT_MIN;
+  map->high = INT_MAX;
+}
+
+/**
+ * @brief Splits the overflowing nodes on the loaded path, from the leaf up
+ * @param map Pointer to the extent map
+ */
+static void split_extent_nodes(struct my_extent_map* map) {
+  for (int level = map->depth - 1; level >= 0 && map->nodes[level]->count > MY_EXTENT_NODE_EXTENTS; level--) {
+    struct my_extent_node* node = map->nodes[level];
+    int middle = node->count / 2;
+
+    // the upper half goes to a new node, which is written right away
+    struct my_extent_node* right = malloc(sizeof(struct my_extent_node));
+    right->leaf = node->leaf;
+    right->count = node->count - middle;
+    memcpy(right->extents, node->extents + middle, right->count * sizeof(struct my_extent));
+    node->count = middle;
+    map->changed[level] = 1;
+
+    struct my_extent record;
+    record.start = right->extents[0].start;
+    record.length = 0;
+    uuid_generate(record.base);
+
+    write_extent_node(record.base, right);
+    free(right);
+
+    if (level > 0) {
+      // the new node goes into the parent right after the split one
+      struct my_extent_node* parent = map->nodes[level - 1];
+      int position = map->positions[level - 1] + 1;
+
+      memmove(parent->extents + position + 1, parent->extents + position, (parent->count - position) * sizeof(struct my_extent));
+      parent->extents[position] = record;
+      parent->count++;
+      map->changed[level - 1] = 1;
+    } else {
+      // the root was split, a new root goes above the two nodes
+      struct my_extent_node* root = malloc(sizeof(struct my_extent_node));
+      root->leaf = 0;
+      root->count = 2;
+      root->extents[0].start = node->extents[0].start;
+      root->extents[0].length = 0;
+      uuid_copy(root->extents[0].base, map->ids[0]);
+      root->extents[1] = record;
+
+      write_extent_node(map->ids[0], node);
+      free(node);
+
+      map->nodes[0] = root;
+      uuid_generate(map->ids[0]);
+      uuid_copy(map->fcb->extent_list, map->ids[0]);
+      map->changed[0] = 1;
+      map->dirty = 1;
+    }
+  }
+
+  // the looked up block can be in either half, its leaf is loaded again
+  unload_extent_nodes(map, 1);
+}
+
+/**
+ * @brief Deletes the data blocks and extents after the new end from a subtree of the extent tree
+ * @param node Pointer to the loaded root of the subtree, it is changed but not written
+ * @param num_blocks Number of blocks that remain in the file
+ * @return Number of deleted extents
+ */
+static int truncate_extent_node(struct my_extent_node* node, int num_blocks) {
+  if (node->leaf) {
+    int count = node->count;
+    truncate_extents(node->extents, &(node->count), num_blocks);
+    return count - node->count;
+  }
+
+  int deleted = 0;
+  struct my_extent_node* child = malloc(sizeof(struct my_extent_node));
+
+  // children are sorted, so go from the end until one keeps some extents
+  while (node->count > 0) {
+    struct my_extent* record = &(node->extents[node->count - 1]);
+
+    read_extent_node(record->base, child);
+    deleted += truncate_extent_node(child, num_blocks);
+
+    if (child->count > 0) {
+      write_extent_node(record->base, child);
+      break;
+    }
+
+    delete_db_object(record->base);
+    node->count--;
+  }
+
+  free(child);
+  return deleted;
+}
+
+/**
+ * @brief Copies the extents of a subtree of the extent tree into an array and deletes the subtree
+ * @param id UUID of the subtree root
+ * @param node Pointer to the loaded root of the subtree
+ * @param extents Array where the extents will be stored
+ * @param count Pointer to the number of extents in the array, it is updated
+ */
+static void collect_extent_node(uuid_t id, struct my_extent_node* node, struct my_extent* extents, int* count) {
+  if (node->leaf) {
+    memcpy(extents + *count, node->extents, node->count * sizeof(struct my_extent));
+    *count += node->count;
+  } else {
+    struct my_extent_node* child = malloc(sizeof(struct my_extent_node));
+
+    for (int i = 0; i < node->count; i++) {
+      read_extent_node(node->extents[i].base, child);
+      collect_extent_node(node->extents[i].base, child, extents, count);
+    }
+
+    free(child);
+  }
+
+  delete_db_object(id);
+}
+
+void open_extents(struct my_fcb* file_fcb, struct my_extent_map* map) {
+  map->fcb = file_fcb;
+  map->total = file_fcb->num_extents;
+  map->last = 0;
+  map->dirty = 0;
+  map->depth = 0;
+  map->low = map->high = 0;
+
+  // a few extents are kept in the FCB, leaves of a tree are loaded by lookups
+  if (map->total > MY_FCB_EXTENTS) {
+    map->extents = NULL;
+    map->count = 0;
+  } else {
+    memcpy(map->fcb_extents, file_fcb->extents, map->total * sizeof(struct my_extent));
+    map->extents = map->fcb_extents;
+    map->count = map->total;
+  }
+}
+
+void get_block_id(struct my_extent_map* map, int block, uuid_t id) {
+  load_extent_leaf(map, block);
+  int i = find_extent(map, block);
+
+  if (i >= 0 && block < map->extents[i].start + map->extents[i].length) {
+    get_derived_id(map->extents[i].base, block - map->extents[i].start, id);
+  } else {
+    uuid_clear(id);
+  }
+}
+
+void allocate_block(struct my_extent_map* map, int block, uuid_t id) {
+  load_extent_leaf(map, block);
+  int i = find_extent(map, block);
+  change_usage(1, 0);
+
+  // only the current leaf changes in a tree, otherwise the FCB
+  if (map->depth > 0) {
+    map->changed[map->depth - 1] = 1;
+  } else {
+    map->dirty = 1;
+  }
+
+  // the block directly follows an extent, make the extent longer
+  if (i >= 0 && map->extents[i].start + map->extents[i].length == block) {
+    get_derived_id(map->extents[i].base, map->extents[i].length, id);
+    map->extents[i].length++;
+    return;
+  }
+
+  // insert a new extent after the one found, keeping the array sorted, there
+  // is always space for one more
+  i++;
+  memmove(&(map->extents[i + 1]), &(map->extents[i]), (map->count - i) * sizeof(struct my_extent));
+  map->count++;
+  map->total++;
+  map->dirty = 1;
+
+  struct my_extent* extent = &(map->extents[i]);
+  extent->start = block;
+  extent->length = 1;
+
+  // the last bytes of the base UUID are used for the block offset
+  uuid_generate(extent->base);
+  get_derived_id(extent->base, 0, extent->base);
+
+  uuid_copy(id, extent->base);
+
+  if (map->depth > 0) {
+    map->nodes[map->depth - 1]->count = map->count;
+
+    if (map->count > MY_EXTENT_NODE_EXTENTS) {
+      split_extent_nodes(map);
+    }
+  } else if (map->count > MY_FCB_EXTENTS) {
+    // the extents no longer fit in the FCB
+    create_extent_tree(map);
+  }
+}
+
+void free_blocks(struct my_extent_map* map, int num_blocks) {
+  map->last = 0;
+
+  if (map->total <= MY_FCB_EXTENTS) {
+    if (truncate_extents(map->extents, &(map->count), num_blocks)) {
+      map->total = map->count;
+      map->dirty = 1;
+    }
+
+    return;
+  }
+
+  // the changed nodes are written first, the tree is then changed in the database
+  unload_extent_nodes(map, 0);
+
+  struct my_fcb* file_fcb = map->fcb;
+  struct my_extent_node* root = malloc(sizeof(struct my_extent_node));
+  read_extent_node(file_fcb->extent_list, root);
+
+  map->total -= truncate_extent_node(root, num_blocks);
+  map->dirty = 1;
+
+  // a root with only one child is replaced by the child
+  while (!root->leaf && root->count == 1) {
+    delete_db_object(file_fcb->extent_list);
+    uuid_copy(file_fcb->extent_list, root->extents[0].base);
+    read_extent_node(file_fcb->extent_list, root);
+  }
+
+  if (map->total > MY_FCB_EXTENTS) {
+    write_extent_node(file_fcb->extent_list, root);
+  } else {
+    // the extents fit in the FCB again, the tree is not needed
+    map->count = 0;
+    collect_extent_node(file_fcb->extent_list, root, map->fcb_extents, &(map->count));
+    uuid_clear(file_fcb->extent_list);
+    map->extents = map->fcb_extents;
+  }
+
+  free(root);
+}
+
+void close_extents(struct my_extent_map* map) {
+  struct my_fcb* file_fcb = map->fcb;
+
+  if (map->total > MY_FCB_EXTENTS) {
+    // only the changed nodes of the tree are written
+    unload_extent_nodes(map, 0);
+  } else if (map->dirty) {
+    memcpy(file_fcb->extents, map->fcb_extents, map->total * sizeof(struct my_extent));
+  }
+
+  if (map->dirty) {
+    file_fcb->num_extents = map->total;
+  }
+}
+
+int read_file(uuid_t *id, struct my_fcb* file_fcb) {
+  // the pinned root and cached FCBs are copied with the cache locked, and a
+  // FCB read from the database cannot be replaced by update_file before it
+  // is cached, otherwise an old copy would be kept in the cache
+  lock_mutex(&fcb_cache_lock);
+
+  if (!uuid_is_null(root_fcb.id) && uuid_compare(*id, root_fcb.id) == 0) {
+    memcpy(file_fcb, &root_fcb, get_fcb_record_size(&root_fcb));
+    unlock_mutex(&fcb_cache_lock);
+    return 0;
+  }
+
+  struct my_fcb* cached_fcb = get_cached_fcb(*id);
+
+  if (cached_fcb != NULL) {
+    memcpy(file_fcb, cached_fcb, get_fcb_record_size(cached_fcb));
+    unlock_mutex(&fcb_cache_lock);
+    return 0;
+  }
+
+  // a single lookup both checks that the FCB exists and reads it
+  if (fetch_db_object(*id, file_fcb, sizeof(struct my_fcb)) < 0) {
+    unlock_mutex(&fcb_cache_lock);
+    return -1;
+  }
+
+  add_cached_fcb(file_fcb);
+
+  unlock_mutex(&fcb_cache_lock);
+  return 0;
+}
+
+size_t get_fcb_record_size(struct my_fcb* file_fcb) {
+  if (file_fcb->size <= MY_INLINE_SIZE) {
+    return offsetof(struct my_fcb, inline_data) + file_fcb->size;
+  } else if (file_fcb->num_extents <= MY_FCB_EXTENTS) {
+    return offsetof(struct my_fcb, extents) + file_fcb->num_extents * sizeof(struct my_extent);
+  } else {
+    return offsetof(struct my_fcb, extents);
+  }
+}
+
+void update_file(struct my_fcb* file_fcb) {
+  lock_mutex(&fcb_cache_lock);
+
+  // the unused part of the inline data or extents is not stored
+  write_db_object(file_fcb->id, file_fcb, get_fcb_record_size(file_fcb));
+
+  // the cache is written through, so cached FCBs never need to be saved
+  add_cached_fcb(file_fcb);
+
+  // and so is the pinned root
+  if (uuid_compare(file_fcb->id, root_fcb.id) == 0) {
+    memcpy(&root_fcb, file_fcb, get_fcb_record_size(file_fcb));
+  }
+
+  unlock_mutex(&fcb_cache_lock);
+}
+
+size_t size_round_up_to(size_t num, size_t up_to) {
+  size_t rem = num % up_to;
+
+  if (rem > 0) {
+    // add to the number so that it is a multiple of up_to
+    return num + (up_to - rem);
+  } else {
+    return num;
+  }
+}
+
+size_t size_round_down_to(size_t num, size_t up_to) {
+  size_t rem = num % up_to;
+
+  // subtract from the number so that it is a multiple of up_to
+  return num - rem;
+}
+
+int get_num_blocks(size_t size) {
+  return size_round_up_to(size, MY_BLOCK_SIZE) / MY_BLOCK_SIZE;
+}
+
+void get_block_indexes(size_t size, off_t offset, int* first, int* last) {
+  *first = size_round_down_to(offset, MY_BLOCK_SIZE) / MY_BLOCK_SIZE;
+  *last = size_round_up_to(offset + size, MY_BLOCK_SIZE) / MY_BLOCK_SIZE - 1;
+}
+
+void remove_file(struct my_fcb* file_fcb) {
+  // large directories have index nodes outside of their data
+  if (is_directory(file_fcb)) {
+    free_dir_index(file_fcb);
+  }
+
+  struct my_extent_map map;
+  open_extents(file_fcb, &map);
+
+  // delete all data blocks and the extent list
+  free_blocks(&map, 0);
+  close_extents(&map);
+
+  // and finally the FCB, a reader must not cache it again in between
+  lock_mutex(&fcb_cache_lock);
+  remove_cached_fcb(file_fcb->id);
+  delete_db_object(file_fcb->id);
+  unlock_mutex(&fcb_cache_lock);
+
+  change_usage(0, -1);
+}
+
+/**
+ * @brief Reads a range of the file data from its data blocks into the buffer
+ * @param fcb Pointer to the FCB of the read file
+ * @param buffer Buffer for storing the read data
+ * @param size Size of the buffer
+ * @param offset Offset in the file to read data from
+ */
+static void read_file_blocks(struct my_fcb* file_fcb, void* buffer, size_t size, off_t offset) {
+  struct my_extent_map map;
+  open_extents(file_fcb, &map);
+
+  // get the indexes of the first and last data block needed for reading
+  int first_block, last_block;
+  get_block_indexes(size, offset, &first_block, &last_block);
 
   // go through the data blocks and read data from them into the buffer
   for (int block = first_block; block <= last_block; block++) {
-    read_block_to_buffer(index_block.entries[block], block, buffer, size, offset);
+    uuid_t block_id;
+    get_block_id(&map, block, block_id);
+    read_block_to_buffer(block_id, block, buffer, size, offset);
+  }
+
+  close_extents(&map);
+}
+
+/**
+ * @brief Writes to a range of the file data blocks from the buffer
+ *
+ * The file size is not changed, the FCB needs to be written with update_file
+ * afterwards because the extents might have changed.
+ *
+ * @param fcb Pointer to the FCB of the updated file
+ * @param buffer Buffer for reading the written data
+ * @param size Size of the buffer
+ * @param offset Offset in the file to write data to
+ */
+static void write_file_blocks(struct my_fcb* file_fcb, void* buffer, size_t size, off_t offset) {
+  struct my_extent_map map;
+  open_extents(file_fcb, &map);
+
+  // get the indexes of the first and last data block needed for writing
+  int first_block, last_block;
+  get_block_indexes(size, offset, &first_block, &last_block);
+
+  // go through the data blocks and write data to them from the buffer
+  for (int block = first_block; block <= last_block; block++) {
+    uuid_t block_id;
+    get_block_id(&map, block, block_id);
+
+    // holes get a data block when they are first written to
+    char is_hole = uuid_is_null(block_id);
+    if (is_hole) {
+      allocate_block(&map, block, block_id);
+    }
+
+    write_buffer_to_block(block_id, is_hole, block, buffer, size, offset);
+  }
+
+  close_extents(&map);
+}
+
+/**
+ * @brief Deletes the data blocks after the new end of the file
+ *
+ * The file size is not changed, the FCB needs to be written with update_file
+ * afterwards because the extents might have changed.
+ *
+ * @param fcb Pointer to the FCB of the shrunk file
+ * @param size New size of the file, smaller than the current one
+ */
+static void shrink_file_blocks(struct my_fcb* file_fcb, size_t size) {
+  /** @var Number of data blocks the file needs to have */
+  int new_num_blocks = get_num_blocks(size);
+
+  struct my_extent_map map;
+  open_extents(file_fcb, &map);
+
+  // delete the data blocks that are no longer used
+  free_blocks(&map, new_num_blocks);
+
+  // data after the end of the file in the last block has to be cleared,
+  // otherwise it would be visible again if the file grows
+  if (size % MY_BLOCK_SIZE != 0) {
+    uuid_t block_id;
+    get_block_id(&map, new_num_blocks - 1, block_id);
+
+    if (!uuid_is_null(block_id)) {
+      void* block_data = malloc(MY_BLOCK_SIZE);
+      read_db_object(block_id, block_data, MY_BLOCK_SIZE);
+
+      memset(block_data + size % MY_BLOCK_SIZE, 0, MY_BLOCK_SIZE - size % MY_BLOCK_SIZE);
+
+      write_db_object(block_id, block_data, MY_BLOCK_SIZE);
+
+      // the cached copy of the block would be out of date
+      update_cached_block(block_id, block_data, 0);
+      free(block_data);
+    }
+  }
+
+  // save changes made in the extents
+  close_extents(&map);
+}
+
+void truncate_file(struct my_fcb* file_fcb, size_t size) {
+  if (size <= MY_INLINE_SIZE && file_fcb->size <= MY_INLINE_SIZE) {
+    // the data stays in the FCB, new data at the end reads as zeroes
+    if ((off_t)size > file_fcb->size) {
+      memset(file_fcb->inline_data + file_fcb->size, 0, size - file_fcb->size);
+    }
+
+  } else if (size <= MY_INLINE_SIZE) {
+    // the file is now small enough to be stored in the FCB, the remaining
+    // data is moved there and all data blocks are deleted
+    char inline_data[MY_INLINE_SIZE];
+    read_file_blocks(file_fcb, inline_data, size, 0);
+    shrink_file_blocks(file_fcb, 0);
+    memcpy(file_fcb->inline_data, inline_data, size);
+
+  } else if (file_fcb->size <= MY_INLINE_SIZE) {
+    // the file no longer fits in the FCB, move its data into the first block,
+    // the rest of the new blocks are holes
+    if (file_fcb->size > 0) {
+      write_file_blocks(file_fcb, file_fcb->inline_data, file_fcb->size, 0);
+    }
+
+  } else if ((off_t)size < file_fcb->size) {
+    // new blocks at the end of the file are holes, they are only created once
+    // they are written to, so only shrinking the file changes the data blocks
+    shrink_file_blocks(file_fcb, size);
+  }
+
+  // finally update file size and modification time
+  file_fcb->size = size;
+  file_fcb->mtime = time(0);
+  update_file(file_fcb);
+}
+
+void read_block_to_buffer(uuid_t id, int block_num, void* buffer, size_t size, off_t offset) {
+  /** @var Offset in the file of the first byte of the block */
+  off_t block_start = (off_t)block_num * MY_BLOCK_SIZE;
+  /** @var Offset in the file of the last byte of the block */
+  off_t block_end = block_start + MY_BLOCK_SIZE - 1;
+
+  /** @var Offset in the file of the first byte of the read data */
+  off_t data_start = offset;
+  /** @var Offset in the file of the last byte of the read data */
+  off_t data_end = offset + size - 1;
+
+  // only the part of the requested data range inside the block is read
+  /** @var Offset in the file of the first byte read from the block */
+  off_t range_start = (block_start > data_start) ? block_start : data_start;
+  /** @var Offset in the file of the last byte read from the block */
+  off_t range_end = (block_end < data_end) ? block_end : data_end;
+
+  /** @var Where the range should be stored in the buffer */
+  void* range_buffer = buffer + (range_start - data_start);
+  /** @var Size of the range */
+  size_t range_size = range_end - range_start + 1;
+
+  // the block is a hole, fill the range with zeroes
+  if (uuid_is_null(id)) {
+    memset(range_buffer, 0, range_size);
+    return;
+  }
+
+  // look for the block in the cache first, cached data can only be used
+  // while the cache is locked, otherwise another thread could evict it
+  lock_mutex(&block_cache_lock);
+  void* block_data = get_cached_block(id);
+
+  if (block_data != NULL) {
+    // copy the range from the cached block into the buffer
+    memcpy(range_buffer, block_data + (range_start - block_start), range_size);
+    unlock_mutex(&block_cache_lock);
+    return;
+  }
+
+  unsigned long changes = block_changes;
+  unlock_mutex(&block_cache_lock);
+
+  if (block_cache.capacity == 0) {
+    // the cache is disabled, copy only the range straight into the buffer
+    read_db_object_range(id, range_buffer, range_size, range_start - block_start);
+    return;
+  }
+
+  // read the block from the database with the cache unlocked, so that reads
+  // of cached blocks in other threads do not wait for it, and then cache it
+  void* read_data = malloc(MY_BLOCK_SIZE);
+  read_db_object(id, read_data, MY_BLOCK_SIZE);
+  memcpy(range_buffer, read_data + (range_start - block_start), range_size);
+
+  cache_read_block(id, read_data, changes);
+  free(read_data);
+}
+
+void read_file_data(struct my_fcb* file_fcb, void* buffer, size_t size, off_t offset) {
+  if (file_fcb->size <= MY_INLINE_SIZE) {
+    memcpy(buffer, file_fcb->inline_data + offset, size);
+  } else {
+    read_file_blocks(file_fcb, buffer, size, offset);
+  }
+}
+
+void write_buffer_to_block(uuid_t id, char is_new, int block_num, void* buffer, size_t size, off_t offset) {
+  /** @var Offset in the file of the first byte of the block */
+  off_t block_start = (off_t)block_num * MY_BLOCK_SIZE;
+  /** @var Offset in the file of the last byte of the block */
+  off_t block_end = block_start + MY_BLOCK_SIZE - 1;
+
+  /** @var Offset in the file of the first byte of the read data */
+  off_t data_start = offset;
+  /** @var Offset in the file of the last byte of the read data */
+  off_t data_end = offset + size - 1;
+
+  // the whole block is overwritten, store it straight from the buffer
+  if (data_start <= block_start && data_end >= block_end) {
+    write_db_object(id, buffer + (block_start - data_start), MY_BLOCK_SIZE);
+
+    // keep the cached copy of the block up to date, if there is one
+    if (!is_new) {
+      update_cached_block(id, buffer + (block_start - data_start), 0);
+    }
+
+    return;
   }
-}
 
-void write_buffer_to_block(uuid_t id, int block_num, void* buffer, size_t size, off_t offset) {
-  // read the data from the data block into memory
+  // get the data of the data block into memory, preferably from the cache
   // we need to do this because we will be writing the whole block back into
   // database, even though only a part of it may change
+  // a new block starts filled with zeroes instead
   void* block_data = malloc(MY_BLOCK_SIZE);
-  read_db_object(id, block_data, MY_BLOCK_SIZE);
+  void* cached_data = NULL;
 
-  /** @var Offset in the file of the first byte of the block */
-  off_t block_start = block_num * MY_BLOCK_SIZE;
-  /** @var Offset in the file of the last byte of the block */
-  off_t block_end = block_start + MY_BLOCK_SIZE - 1;
+  if (is_new) {
+    memset(block_data, 0, MY_BLOCK_SIZE);
+  } else {
+    // the cached data is copied with the cache locked, the database is read
+    // with it unlocked
+    lock_mutex(&block_cache_lock);
+    cached_data = get_cached_block(id);
 
-  /** @var Offset in the file of the first byte of the read data */
-  off_t data_start = offset;
-  /** @var Offset in the file of the last byte of the read data */
-  off_t data_end = offset + size - 1;
+    if (cached_data != NULL) {
+      memcpy(block_data, cached_data, MY_BLOCK_SIZE);
+    }
+
+    unlock_mutex(&block_cache_lock);
+
+    if (cached_data == NULL) {
+      read_db_object(id, block_data, MY_BLOCK_SIZE);
+    }
+  }
 
   // needed data range is fully contained in the block
   if (block_start <= data_start && block_end >= data_end) {
@@ -1044,190 +3476,806 @@ void write_buffer_to_block(uuid_t id, int block_num, void* buffer, size_t size,
     memcpy(block_data, buffer + (block_start - data_start), data_end - block_start + 1);
   }
 
-  // needed data range starts and ends outside the block
-  if (block_start > data_start && block_end < data_end) {
-    // copy data from the block into the whole data block
-    memcpy(block_data, buffer + (block_start - data_start), MY_BLOCK_SIZE);
-  }
-
-  // save the changed data in the block back to the database
+  // save the changed data in the block back to the database and the cache
   write_db_object(id, block_data, MY_BLOCK_SIZE);
+  update_cached_block(id, block_data, 1);
   free(block_data);
 }
 
 void write_file_data(struct my_fcb* file_fcb, void* buffer, size_t size, off_t offset) {
-  // if we are writing outside the current file data, it needs to be expanded
-  // first to be able to accommodate the new data
-  if ((offset + size) > file_fcb->size) {
-    truncate_file(file_fcb, offset + size);
+  /** @var Size of the file after the write */
+  off_t new_size = file_fcb->size;
+  if ((offset + (off_t)size) > new_size) {
+    new_size = offset + size;
   }
 
-  // read the index block from the database
-  struct my_index index_block;
-  read_db_object(file_fcb->data, &index_block, sizeof(index_block));
+  if (new_size <= MY_INLINE_SIZE) {
+    // the data stays in the FCB, a gap after the current end reads as zeroes
+    if (offset > file_fcb->size) {
+      memset(file_fcb->inline_data + file_fcb->size, 0, offset - file_fcb->size);
+    }
 
-  // get the indexes of the first and last data block needed for writing
-  int first_block, last_block;
-  get_block_indexes(size, offset, &first_block, &last_block);
+    memcpy(file_fcb->inline_data + offset, buffer, size);
 
-  // go through the data blocks and write data to them from the buffer
-  for (int block = first_block; block <= last_block; block++) {
-    write_buffer_to_block(index_block.entries[block], block, buffer, size, offset);
+  } else {
+    // the file no longer fits in the FCB, move its data into the first block
+    if (file_fcb->size > 0 && file_fcb->size <= MY_INLINE_SIZE) {
+      write_file_blocks(file_fcb, file_fcb->inline_data, file_fcb->size, 0);
+    }
+
+    // if we are writing outside the current file data, the new blocks are
+    // holes until they are written to below
+    write_file_blocks(file_fcb, buffer, size, offset);
   }
 
-  // finally update modification time
+  // finally update size and modification time
+  file_fcb->size = new_size;
   file_fcb->mtime = time(0);
   update_file(file_fcb);
 }
 
 struct my_dir_entry* get_dir_entry(void* dir_data, int offset) {
-  return dir_data + sizeof(struct my_dir_header) + offset * sizeof(struct my_dir_entry);
+  return dir_data + offset;
 }
 
-int add_dir_entry(struct my_fcb* dir_fcb, struct my_fcb* file_fcb, const char* name) {
-  /** @var Size of the directory data */
-  size_t data_size = dir_fcb->size;
-  /** @var Size of the data if there is a new entry created */
-  size_t max_size = data_size + sizeof(struct my_dir_entry);
+size_t get_dir_entry_size(const char* name) {
+  size_t size = offsetof(struct my_dir_entry, name) + strnlen(name, MY_MAX_PATH - 1) + 1;
+  return size_round_up_to(size, MY_DIR_ENTRY_ALIGN);
+}
+
+/**
+ * @brief Reads a directory entry from the directory data
+ * @param dir_fcb Pointer to the FCB of the directory
+ * @param offset Offset of the entry in the directory data
+ * @param entry Pointer to a directory entry where the entry will be stored
+ */
+static void read_dir_entry(struct my_fcb* dir_fcb, int offset, struct my_dir_entry* entry) {
+  // entries are packed, so the last one can be shorter than the struct
+  size_t size = sizeof(struct my_dir_entry);
+
+  if (offset + (off_t)size > dir_fcb->size) {
+    size = dir_fcb->size - offset;
+  }
+
+  read_file_data(dir_fcb, entry, size, offset);
+}
+
+/**
+ * @brief Calculates the key of a directory entry
+ * @param name Name of the entry
+ * @param offset Offset of the entry in the directory data
+ * @return Key of the entry
+ */
+static struct my_dir_key get_dir_key(const char* name, int offset) {
+  struct my_dir_key key = {get_name_hash(name), offset};
+  return key;
+}
+
+/**
+ * @brief Compares two directory entry keys
+ * @param key1 First key
+ * @param key2 Second key
+ * @return Negative if the first key goes before the second one, 0 if they are equal, positive otherwise
+ */
+static int compare_dir_keys(struct my_dir_key key1, struct my_dir_key key2) {
+  if (key1.hash != key2.hash) {
+    return key1.hash < key2.hash ? -1 : 1;
+  }
+
+  return (key1.offset > key2.offset) - (key1.offset < key2.offset);
+}
+
+/**
+ * @brief Compares two directory entry keys, used with qsort
+ * @param key1 Pointer to the first key
+ * @param key2 Pointer to the second key
+ * @return Negative if the first key goes before the second one, 0 if they are equal, positive otherwise
+ */
+static int compare_dir_key_items(const void* key1, const void* key2) {
+  return compare_dir_keys(*(const struct my_dir_key*) key1, *(const struct my_dir_key*) key2);
+}
+
+/**
+ * @brief Makes a cookie for resuming iteration from a directory entry key
+ * @param key Key of the entry
+ * @return Cookie of the entry
+ */
+static off_t get_dir_cookie(struct my_dir_key key) {
+  // offsets are positive ints, so the key fits in 63 bits
+  return ((off_t) key.hash << 31) | key.offset;
+}
+
+/**
+ * @brief Gets the directory entry key back from a cookie
+ * @param cookie Cookie made by get_dir_cookie
+ * @return Key of the entry
+ */
+static struct my_dir_key get_cookie_key(off_t cookie) {
+  struct my_dir_key key = {(unsigned int) (cookie >> 31), (int) (cookie & INT_MAX)};
+  return key;
+}
+
+/**
+ * @brief Reads a node of a directory index
+ * @param index_id Base UUID of the index nodes
+ * @param number Number of the node
+ * @param node Pointer to a node struct where the node will be stored
+ */
+static void read_dir_node(uuid_t index_id, int number, struct my_dir_node* node) {
+  uuid_t node_id;
+  get_derived_id(index_id, number, node_id);
+
+  // only the used records are stored
+  read_db_object(node_id, node, offsetof(struct my_dir_node, records) + MY_DIR_NODE_RECORDS * sizeof(struct my_dir_record));
+}
+
+/**
+ * @brief Writes a node of a directory index
+ * @param index_id Base UUID of the index nodes
+ * @param number Number of the node
+ * @param node Pointer to the node
+ */
+static void write_dir_node(uuid_t index_id, int number, struct my_dir_node* node) {
+  uuid_t node_id;
+  get_derived_id(index_id, number, node_id);
+
+  write_db_object(node_id, node, offsetof(struct my_dir_node, records) + node->count * sizeof(struct my_dir_record));
+}
+
+/**
+ * @brief Allocates a number for a new index node, free nodes are reused first
+ * @param dir_header Pointer to the directory header, the free list or the number of nodes is updated
+ * @return Number of the node
+ */
+static int allocate_dir_node(struct my_dir_header* dir_header) {
+  if (dir_header->index_free < 0) {
+    return dir_header->index_nodes++;
+  }
+
+  int number = dir_header->index_free;
+
+  struct my_dir_node* node = malloc(sizeof(struct my_dir_node));
+  read_dir_node(dir_header->index_id, number, node);
+  dir_header->index_free = node->link;
+  free(node);
+
+  return number;
+}
+
+/**
+ * @brief Adds an index node which is no longer used to the free list
+ * @param dir_header Pointer to the directory header, the free list is updated
+ * @param number Number of the node
+ */
+static void free_dir_node(struct my_dir_header* dir_header, int number) {
+  // free nodes have no records, so only the node header is stored
+  struct my_dir_node node;
+  node.leaf = 1;
+  node.count = 0;
+  node.link = dir_header->index_free;
+
+  write_dir_node(dir_header->index_id, number, &node);
+  dir_header->index_free = number;
+}
+
+/**
+ * @brief Finds the position of the first record in the node after the key
+ * @param node Pointer to the node
+ * @param key Searched key
+ * @return Position of the first record with a larger key, or the number of records
+ */
+static int find_node_position(struct my_dir_node* node, struct my_dir_key key) {
+  int low = 0;
+  int high = node->count;
+
+  while (low < high) {
+    int middle = (low + high) / 2;
+
+    if (compare_dir_keys(node->records[middle].key, key) <= 0) {
+      low = middle + 1;
+    } else {
+      high = middle;
+    }
+  }
+
+  return low;
+}
+
+/**
+ * @brief Gets the child of an inner index node before a position
+ * @param node Pointer to the node
+ * @param position Position returned by find_node_position
+ * @return Number of the child node which can contain the key
+ */
+static int get_node_child(struct my_dir_node* node, int position) {
+  return position == 0 ? node->link : node->records[position - 1].child;
+}
+
+/**
+ * @brief Inserts a record into an index node, the node can overflow
+ * @param node Pointer to the node
+ * @param position Position of the new record
+ * @param record Inserted record
+ */
+static void insert_node_record(struct my_dir_node* node, int position, struct my_dir_record record) {
+  memmove(node->records + position + 1, node->records + position, (node->count - position) * sizeof(struct my_dir_record));
+  node->records[position] = record;
+  node->count++;
+}
+
+/**
+ * @brief Removes a record from an index node
+ * @param node Pointer to the node
+ * @param position Position of the removed record
+ */
+static void delete_node_record(struct my_dir_node* node, int position) {
+  memmove(node->records + position, node->records + position + 1, (node->count - position - 1) * sizeof(struct my_dir_record));
+  node->count--;
+}
+
+/**
+ * @brief Loads the index leaf which can contain the key
+ * @param index_id Base UUID of the index nodes
+ * @param root Number of the root node
+ * @param key Searched key
+ * @param node Pointer to a node struct where the leaf will be stored
+ * @return Position of the first record in the leaf after the key
+ */
+static int find_dir_leaf(uuid_t index_id, int root, struct my_dir_key key, struct my_dir_node* node) {
+  read_dir_node(index_id, root, node);
+
+  // go down the tree, reading one node on each level
+  while (!node->leaf) {
+    read_dir_node(index_id, get_node_child(node, find_node_position(node, key)), node);
+  }
+
+  return find_node_position(node, key);
+}
+
+/**
+ * @brief Splits an overflowing index node into two
+ * @param dir_header Pointer to the directory header, a node is allocated
+ * @param number Number of the split node
+ * @param node Pointer to the split node
+ * @param split Pointer where the record of the new node for the parent will be stored
+ */
+static void split_dir_node(struct my_dir_header* dir_header, int number, struct my_dir_node* node, struct my_dir_record* split) {
+  int middle = node->count / 2;
+
+  split->key = node->records[middle].key;
+  split->child = allocate_dir_node(dir_header);
+
+  struct my_dir_node* right = malloc(sizeof(struct my_dir_node));
+  right->leaf = node->leaf;
+
+  if (node->leaf) {
+    // leaves keep all records and are linked in key order
+    right->link = node->link;
+    node->link = split->child;
+
+    right->count = node->count - middle;
+    memcpy(right->records, node->records + middle, right->count * sizeof(struct my_dir_record));
+  } else {
+    // the middle key moves to the parent, its child becomes the first child
+    right->link = node->records[middle].child;
+
+    right->count = node->count - middle - 1;
+    memcpy(right->records, node->records + middle + 1, right->count * sizeof(struct my_dir_record));
+  }
+
+  node->count = middle;
+
+  write_dir_node(dir_header->index_id, number, node);
+  write_dir_node(dir_header->index_id, split->child, right);
+
+  free(right);
+}
+
+/**
+ * @brief Adds a key to a subtree of a directory index
+ * @param dir_header Pointer to the directory header
+ * @param number Number of the subtree root node
+ * @param key Added key
+ * @param split Pointer where the record of a new sibling node will be stored
+ * @return 1 if the node was split, otherwise 0
+ */
+static char add_node_key(struct my_dir_header* dir_header, int number, struct my_dir_key key, struct my_dir_record* split) {
+  struct my_dir_node* node = malloc(sizeof(struct my_dir_node));
+  read_dir_node(dir_header->index_id, number, node);
+
+  int position = find_node_position(node, key);
+  struct my_dir_record record = {key, -1};
+
+  if (!node->leaf && !add_node_key(dir_header, get_node_child(node, position), key, &record)) {
+    // the child did not change its range, nothing else to do
+    free(node);
+    return 0;
+  }
+
+  // in inner nodes, the new sibling of the child goes right after it
+  insert_node_record(node, position, record);
+
+  char is_split = node->count > MY_DIR_NODE_RECORDS;
+
+  if (is_split) {
+    split_dir_node(dir_header, number, node, split);
+  } else {
+    write_dir_node(dir_header->index_id, number, node);
+  }
+
+  free(node);
+  return is_split;
+}
 
-  // load the directory data from the database
-  // buffer is big enough to add a new directory entry if needed
-  void* dir_data = malloc(max_size);
-  read_file_data(dir_fcb, dir_data, data_size, 0);
+/**
+ * @brief Merges a child with too few records with its sibling, or moves
+ * records between them if they do not fit in one node
+ * @param dir_header Pointer to the directory header, a merged node is freed
+ * @param parent Pointer to the parent node, it is changed but not written
+ * @param position Position of the child in the parent
+ */
+static void fix_dir_node(struct my_dir_header* dir_header, struct my_dir_node* parent, int position) {
+  // the first child has a sibling only on the right, others use the left one
+  int left_position = position > 0 ? position - 1 : 0;
+  int right_number = get_node_child(parent, left_position + 1);
+  struct my_dir_record* separator = &(parent->records[left_position]);
+
+  struct my_dir_node* left = malloc(sizeof(struct my_dir_node));
+  struct my_dir_node* right = malloc(sizeof(struct my_dir_node));
+  read_dir_node(dir_header->index_id, get_node_child(parent, left_position), left);
+  read_dir_node(dir_header->index_id, right_number, right);
+
+  // put the records of both nodes in order, in inner nodes the separator
+  // from the parent goes between them
+  struct my_dir_record* records = malloc((2 * MY_DIR_NODE_RECORDS + 1) * sizeof(struct my_dir_record));
+  int count = left->count;
+  memcpy(records, left->records, left->count * sizeof(struct my_dir_record));
+
+  if (!left->leaf) {
+    records[count].key = separator->key;
+    records[count].child = right->link;
+    count++;
+  }
 
-  struct my_dir_header* dir_header = dir_data;
+  memcpy(records + count, right->records, right->count * sizeof(struct my_dir_record));
+  count += right->count;
 
-  /** @var Directory entry that is not currently used */
-  struct my_dir_entry* free_entry;
+  if (count <= MY_DIR_NODE_RECORDS) {
+    // all records fit in the left node, the right one is freed
+    left->count = count;
+    memcpy(left->records, records, count * sizeof(struct my_dir_record));
 
-  if (dir_header->first_free > -1) {
-    // there is an unused entry in the directory, we can use it
-    free_entry = get_dir_entry(dir_data, dir_header->first_free);
+    if (left->leaf) {
+      left->link = right->link;
+    }
 
-    // update the free list header to point to the next free entry
-    dir_header->first_free = free_entry->next_free;
+    delete_node_record(parent, left_position);
+    free_dir_node(dir_header, right_number);
   } else {
+    // split the records evenly, in inner nodes the middle one goes to the parent
+    int middle = count / 2;
+    separator->key = records[middle].key;
+
+    left->count = middle;
+    memcpy(left->records, records, middle * sizeof(struct my_dir_record));
+
+    if (left->leaf) {
+      right->count = count - middle;
+      memcpy(right->records, records + middle, right->count * sizeof(struct my_dir_record));
+    } else {
+      right->link = records[middle].child;
+      right->count = count - middle - 1;
+      memcpy(right->records, records + middle + 1, right->count * sizeof(struct my_dir_record));
+    }
+
+    write_dir_node(dir_header->index_id, right_number, right);
+  }
+
+  write_dir_node(dir_header->index_id, get_node_child(parent, left_position), left);
+
+  free(records);
+  free(right);
+  free(left);
+}
+
+/**
+ * @brief Removes a key from a subtree of a directory index
+ * @param dir_header Pointer to the directory header
+ * @param number Number of the subtree root node
+ * @param key Removed key
+ * @return Number of records left in the node
+ */
+static int remove_node_key(struct my_dir_header* dir_header, int number, struct my_dir_key key) {
+  struct my_dir_node* node = malloc(sizeof(struct my_dir_node));
+  read_dir_node(dir_header->index_id, number, node);
+
+  int position = find_node_position(node, key);
+
+  if (node->leaf) {
+    // the key is right before the position if it is in the leaf
+    if (position > 0 && compare_dir_keys(node->records[position - 1].key, key) == 0) {
+      delete_node_record(node, position - 1);
+      write_dir_node(dir_header->index_id, number, node);
+    }
+  } else if (remove_node_key(dir_header, get_node_child(node, position), key) < MY_DIR_NODE_MIN) {
+    fix_dir_node(dir_header, node, position);
+    write_dir_node(dir_header->index_id, number, node);
+  }
+
+  int count = node->count;
+  free(node);
+  return count;
+}
+
+/**
+ * @brief Creates an empty index for a directory
+ * @param dir_header Pointer to the directory header
+ */
+static void create_dir_index(struct my_dir_header* dir_header) {
+  uuid_generate(dir_header->index_id);
+  get_derived_id(dir_header->index_id, 0, dir_header->index_id);
+
+  // the root starts as an empty leaf
+  struct my_dir_node root;
+  root.leaf = 1;
+  root.count = 0;
+  root.link = -1;
+
+  dir_header->index_root = 0;
+  dir_header->index_nodes = 1;
+  dir_header->index_free = -1;
+  write_dir_node(dir_header->index_id, 0, &root);
+}
+
+/**
+ * @brief Adds a directory entry to the directory index
+ * @param dir_header Pointer to the directory header, it is updated when the index grows
+ * @param key Key of the directory entry
+ */
+static void add_index_entry(struct my_dir_header* dir_header, struct my_dir_key key) {
+  struct my_dir_record split;
+
+  if (add_node_key(dir_header, dir_header->index_root, key, &split)) {
+    // the root was split, add a new root above the two nodes
+    struct my_dir_node root;
+    root.leaf = 0;
+    root.count = 0;
+    root.link = dir_header->index_root;
+    insert_node_record(&root, 0, split);
+
+    dir_header->index_root = allocate_dir_node(dir_header);
+    write_dir_node(dir_header->index_id, dir_header->index_root, &root);
+  }
+}
+
+/**
+ * @brief Removes a directory entry from the directory index
+ * @param dir_header Pointer to the directory header, it is updated when the index shrinks
+ * @param key Key of the directory entry
+ */
+static void remove_index_entry(struct my_dir_header* dir_header, struct my_dir_key key) {
+  if (remove_node_key(dir_header, dir_header->index_root, key) > 0) {
+    return;
+  }
+
+  struct my_dir_node* root = malloc(sizeof(struct my_dir_node));
+  read_dir_node(dir_header->index_id, dir_header->index_root, root);
+
+  // the last two children of the root were merged, the merged one is the new root
+  if (!root->leaf) {
+    int old_root = dir_header->index_root;
+    dir_header->index_root = root->link;
+    free_dir_node(dir_header, old_root);
+  }
+
+  free(root);
+}
+
+void free_dir_index(struct my_fcb* dir_fcb) {
+  struct my_dir_header dir_header;
+  read_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+
+  if (uuid_is_null(dir_header.index_id)) {
+    return;
+  }
+
+  // node numbers are allocated sequentially, free nodes are stored too
+  for (int number = 0; number < dir_header.index_nodes; number++) {
+    uuid_t node_id;
+    get_derived_id(dir_header.index_id, number, node_id);
+    delete_db_object(node_id);
+  }
+}
+
+int lookup_dir_entry(struct my_fcb* dir_fcb, const char* name, struct my_dir_entry* entry) {
+  struct my_dir_header dir_header;
+  read_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+
+  if (uuid_is_null(dir_header.index_id)) {
+    // the directory is small, go through all of its entries
+    int offset = sizeof(struct my_dir_header);
+
+    while (offset < dir_fcb->size) {
+      read_dir_entry(dir_fcb, offset, entry);
+
+      if (entry->used && strcmp(entry->name, name) == 0) {
+        return offset;
+      }
+
+      offset += entry->size;
+    }
+
+    return -1;
+  }
+
+  // find the first key with the name hash in the index, offsets are never negative
+  struct my_dir_node* node = malloc(sizeof(struct my_dir_node));
+  struct my_dir_key key = get_dir_key(name, -1);
+
+  int position = find_dir_leaf(dir_header.index_id, dir_header.index_root, key, node);
+  int offset = -1;
+
+  // check the entries with the same hash, they can continue in the next leaves
+  while (offset < 0) {
+    if (position >= node->count) {
+      if (node->link < 0) break;
+
+      read_dir_node(dir_header.index_id, node->link, node);
+      position = 0;
+      continue;
+    }
+
+    struct my_dir_key found = node->records[position++].key;
+
+    if (found.hash != key.hash) break;
+
+    read_dir_entry(dir_fcb, found.offset, entry);
+
+    if (strcmp(entry->name, name) == 0) {
+      offset = found.offset;
+    }
+  }
+
+  free(node);
+  return offset;
+}
+
+int add_dir_entry(struct my_fcb* dir_fcb, struct my_fcb* file_fcb, const char* name) {
+  // only the header and the changed entry are read and written, not the
+  // whole directory
+  struct my_dir_header dir_header;
+  read_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+
+  /** @var Size of the new directory entry */
+  size_t entry_size = get_dir_entry_size(name);
+
+  /** @var New directory entry */
+  struct my_dir_entry entry;
+  /** @var Offset of the new entry */
+  int offset = -1;
+
+  // look for an unused entry which is big enough, starting with the ones of
+  // exactly the needed size so that space is not wasted
+  for (int list = entry_size / MY_DIR_ENTRY_ALIGN; list < MY_DIR_FREE_LISTS; list++) {
+    if (dir_header.free_lists[list] > -1) {
+      offset = dir_header.free_lists[list];
+      read_dir_entry(dir_fcb, offset, &entry);
+
+      // update the free list header to point to the next free entry
+      dir_header.free_lists[list] = entry.next_free;
+      break;
+    }
+  }
+
+  if (offset < 0) {
     // there are no free, unused entries in the directory
 
     // check if we are able to increase the file size
-    if (max_size > MY_MAX_FILE_SIZE) {
+    if (dir_fcb->size + entry_size > MY_MAX_FILE_SIZE) {
       // no space left for the new entry
-      free(dir_data);
       return -1;
     }
 
     // create a new entry at the end
-    free_entry = get_dir_entry(dir_data, dir_header->items);
-
-    // update the number of entries and directory data size
-    dir_header->items++;
-    data_size = max_size;
+    offset = dir_fcb->size;
+    entry.size = entry_size;
   }
 
   // copy the entry name and file UUID into the entry
-  strncpy(free_entry->name, name, MY_MAX_PATH - 1);
-  uuid_copy(free_entry->fcb_id, file_fcb->id);
+  size_t name_length = strnlen(name, MY_MAX_PATH - 1);
+  memcpy(entry.name, name, name_length);
+  entry.name[name_length] = '\0';
+  uuid_copy(entry.fcb_id, file_fcb->id);
 
   // mark the entry as used
-  free_entry->used = 1;
+  entry.used = 1;
+
+  if (uuid_is_null(dir_header.index_id) && offset + entry.size > MY_INLINE_SIZE) {
+    // the directory no longer fits in the FCB, index all of its entries so
+    // that lookups do not need to read the whole directory
+    create_dir_index(&dir_header);
+
+    struct my_dir_iter iter;
+    iterate_dir_entries(dir_fcb, &iter);
+
+    struct my_dir_entry* old_entry;
+
+    // the entries are added in key order
+    while ((old_entry = next_dir_entry(&iter)) != NULL) {
+      add_index_entry(&dir_header, get_dir_key(old_entry->name, iter.offset));
+    }
+
+    clean_dir_iterator(&iter);
+  }
+
+  if (!uuid_is_null(dir_header.index_id)) {
+    add_index_entry(&dir_header, get_dir_key(entry.name, offset));
+  }
 
-  // write changed directory data back to the database
-  write_file_data(dir_fcb, dir_data, data_size, 0);
+  dir_header.num_entries++;
 
-  free(dir_data);
+  // write the changed entry and header back to the database
+  write_file_data(dir_fcb, &entry, entry.size, offset);
+  write_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+
+  // the name may have been cached as missing, or pointing to a replaced file
+  add_cached_dentry(dir_fcb->id, name, file_fcb->id);
 
   return 0;
 }
 
 int remove_dir_entry(struct my_fcb* dir_fcb, const char* name) {
-  // load the directory data from the database
-  void* dir_data = malloc(dir_fcb->size);
-  read_file_data(dir_fcb, dir_data, dir_fcb->size, 0);
+  /** @var Directory entry to be removed */
+  struct my_dir_entry entry;
 
-  struct my_dir_header* dir_header = dir_data;
+  // find the entry, only the index path or the entries of a small directory
+  // are read
+  int offset = lookup_dir_entry(dir_fcb, name, &entry);
 
-  /** @var Directory entry to be removed */
-  struct my_dir_entry* dir_entry;
+  if (offset < 0) {
+    return -1;
+  }
 
-  char found = 0;
-  int offset;
+  struct my_dir_header dir_header;
+  read_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+
+  if (!uuid_is_null(dir_header.index_id)) {
+    remove_index_entry(&dir_header, get_dir_key(entry.name, offset));
+  }
+
+  // mark the entry as unused, its size stays the same
+  entry.used = 0;
+
+  // add the directory entry to the start of the free list for its size
+  int list = entry.size / MY_DIR_ENTRY_ALIGN;
+  entry.next_free = dir_header.free_lists[list];
+  dir_header.free_lists[list] = offset;
+
+  dir_header.num_entries--;
+
+  // write the changed part of the entry and the header back to the database
+  write_file_data(dir_fcb, &entry, offsetof(struct my_dir_entry, name), offset);
+  write_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+
+  // the name is now known to be missing
+  add_cached_dentry(dir_fcb->id, name, zero_uuid);
+
+  return 0;
+}
+
+void iterate_dir_entries(struct my_fcb* dir_fcb, struct my_dir_iter* iter) {
+  iter->dir_fcb = dir_fcb;
+  iter->position = 0;
+  iter->count = 0;
+  iter->keys = NULL;
+  iter->dir_data = NULL;
+  iter->node = NULL;
+  iter->cookie = 0;
+  iter->offset = 0;
+
+  struct my_dir_header dir_header;
+  read_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
+
+  uuid_copy(iter->index_id, dir_header.index_id);
+  iter->index_root = dir_header.index_root;
+
+  if (!uuid_is_null(iter->index_id)) {
+    // the first leaf is loaded when it is needed, seeking can skip it
+    return;
+  }
+
+  // the directory is small, load all of its data from the FCB and sort the
+  // keys of its used entries, so that they go in the same order as in the
+  // index the directory gets when it grows
+  iter->dir_data = malloc(dir_fcb->size);
+  read_file_data(dir_fcb, iter->dir_data, dir_fcb->size, 0);
+
+  iter->keys = malloc(dir_header.num_entries * sizeof(struct my_dir_key));
+
+  for (int offset = sizeof(struct my_dir_header); offset < dir_fcb->size; offset += get_dir_entry(iter->dir_data, offset)->size) {
+    struct my_dir_entry* entry = get_dir_entry(iter->dir_data, offset);
+
+    if (entry->used) {
+      iter->keys[iter->count++] = get_dir_key(entry->name, offset);
+    }
+  }
 
-  // find the entry to remove by the entry name
-  for (offset = 0; offset < dir_header->items; offset++) {
-    dir_entry = get_dir_entry(dir_data, offset);
+  qsort(iter->keys, iter->count, sizeof(struct my_dir_key), compare_dir_key_items);
+}
 
-    // skip unused entries
-    if (!dir_entry->used) continue;
+struct my_dir_entry* next_dir_entry(struct my_dir_iter* iter) {
+  struct my_dir_key key;
+  struct my_dir_entry* entry;
 
-    if (strcmp(dir_entry->name, name) == 0) {
-      found = 1;
-      break;
+  if (uuid_is_null(iter->index_id)) {
+    if (iter->position >= iter->count) {
+      // there no used entries left
+      return NULL;
     }
-  }
 
-  if (found) {
-    // clear the directory entry, this also sets the used field to 0
-    memset(dir_entry, 0, sizeof(struct my_dir_entry));
+    key = iter->keys[iter->position++];
+    entry = get_dir_entry(iter->dir_data, key.offset);
+  } else {
+    if (iter->node == NULL) {
+      seek_dir_iterator(iter, 0);
+    }
 
-    // add the directory entry to the start of the free list
-    dir_entry->next_free = dir_header->first_free;
-    dir_header->first_free = offset;
+    // go through the leaves in key order, skipping an empty root
+    while (iter->position >= iter->node->count) {
+      if (iter->node->link < 0) {
+        return NULL;
+      }
 
-    // write directory data back to the database
-    write_file_data(dir_fcb, dir_data, dir_fcb->size, 0);
+      read_dir_node(iter->index_id, iter->node->link, iter->node);
+      iter->position = 0;
+    }
 
-    return 0;
-  } else {
-    return -1;
+    key = iter->node->records[iter->position++].key;
+    read_dir_entry(iter->dir_fcb, key.offset, &iter->entry);
+    entry = &iter->entry;
   }
-}
-
-void iterate_dir_entries(struct my_fcb* dir_fcb, struct my_dir_iter* iter) {
-  iter->position = 0;
 
-  // load the directory data from the database
-  iter->dir_data = malloc(dir_fcb->size);
-  read_file_data(dir_fcb, iter->dir_data, dir_fcb->size, 0);
+  iter->offset = key.offset;
+  iter->cookie = get_dir_cookie(key);
+  return entry;
 }
 
-struct my_dir_entry* next_dir_entry(struct my_dir_iter* iter) {
-  struct my_dir_header* dir_header = iter->dir_data;
-
-  // start to go through all the remaining directory entries
-  while (iter->position < dir_header->items) {
-    struct my_dir_entry* entry = get_dir_entry(iter->dir_data, iter->position);
+void seek_dir_iterator(struct my_dir_iter* iter, off_t cookie) {
+  // cookies below the smallest entry offset, like 0, go before all keys
+  struct my_dir_key key = get_cookie_key(cookie < 0 ? 0 : cookie);
+  iter->cookie = cookie;
 
-    iter->position++;
+  if (uuid_is_null(iter->index_id)) {
+    // continue with the first key after the cookie, the entry may be gone
+    iter->position = 0;
 
-    // we found an used entry, return it
-    if (entry->used) {
-      return entry;
+    while (iter->position < iter->count && compare_dir_keys(iter->keys[iter->position], key) <= 0) {
+      iter->position++;
     }
+
+    return;
   }
 
-  // there no used entries left
-  return NULL;
+  if (iter->node == NULL) {
+    iter->node = malloc(sizeof(struct my_dir_node));
+  }
+
+  // a cookie after the last key leaves the iterator at the end of the last leaf
+  iter->position = find_dir_leaf(iter->index_id, iter->index_root, key, iter->node);
 }
 
 void clean_dir_iterator(struct my_dir_iter* iter) {
   free(iter->dir_data);
+  free(iter->keys);
+  free(iter->node);
 }
 
 int get_directory_size(struct my_fcb* dir_fcb) {
-  struct my_dir_iter iter;
-  iterate_dir_entries(dir_fcb, &iter);
-
-  int dir_size = 0;
-  struct my_dir_entry* entry;
+  // the number of used entries is kept up to date by add and remove
+  struct my_dir_header dir_header;
+  read_file_data(dir_fcb, &dir_header, sizeof(dir_header), 0);
 
-  // go through all directory entries and increase counter if we find an used entry
-  while ((entry = next_dir_entry(&iter)) != NULL) {
-    if (entry->used) dir_size++;
-  }
-
-  clean_dir_iterator(&iter);
-
-  return dir_size;
+  return dir_header.num_entries;
 }
 
 int link_file(struct my_fcb* dir_fcb, struct my_fcb* file_fcb, const char* name) {
@@ -1267,14 +4315,47 @@ int find_file(const char* path, struct my_user user, struct my_fcb* file_fcb) {
   return find_dir_entry(path, user, &dir_fcb, file_fcb);
 }
 
-int find_dir_entry(const char* const_path, struct my_user user, struct my_fcb* dir_fcb, struct my_fcb* file_fcb) {
-  // read FCB of the root directory
-  struct my_fcb root_dir;
-  read_file(&(root_object.id), &root_dir);
+int find_dir_child(struct my_fcb* dir_fcb, const char* name, struct my_user user, struct my_fcb* file_fcb) {
+  // only directories have entries
+  if (!is_directory(dir_fcb)) {
+    return MYFS_FIND_NO_DIR;
+  }
+
+  // user needs to have execute permissions to access the directory entries
+  if (!can_execute(dir_fcb, user)) {
+    return MYFS_FIND_NO_ACCESS;
+  }
+
+  /** @var UUID of the FCB of the entry, null if there is no such entry */
+  uuid_t entry_id;
+
+  // look the entry up in the dentry cache first, only search the
+  // directory if the name is not cached
+  if (!get_cached_dentry(dir_fcb->id, name, entry_id)) {
+    struct my_dir_entry entry;
+
+    if (lookup_dir_entry(dir_fcb, name, &entry) > -1) {
+      uuid_copy(entry_id, entry.fcb_id);
+    } else {
+      uuid_clear(entry_id);
+    }
+
+    // missing entries are cached too, so repeated misses are cheap
+    add_cached_dentry(dir_fcb->id, name, entry_id);
+  }
+
+  if (uuid_is_null(entry_id)) {
+    return MYFS_FIND_NO_FILE;
+  }
+
+  read_file(&entry_id, file_fcb);
+  return MYFS_FIND_FOUND;
+}
 
-  // we start at the root directory
+int find_dir_entry(const char* const_path, struct my_user user, struct my_fcb* dir_fcb, struct my_fcb* file_fcb) {
+  // we start at the root directory, its FCB is usually pinned in memory
   // if the path is '/' it will be returned as the file
-  memcpy(file_fcb, &root_dir, sizeof(struct my_fcb));
+  read_file(&(root_object.id), file_fcb);
 
   // duplicate the path string so that we can modify it
   // but store the original refernce so that we can free it later
@@ -1289,58 +4370,32 @@ int find_dir_entry(const char* const_path, struct my_user user, struct my_fcb* d
   // requested file
   // if it is NULL, it means we need to continue the tree traversal further
   while (entry_name != NULL) {
-    // the previously loaded file is expected to be a directory
-    // if it isn't, it means some directory in the path does not exist
-    if (!is_directory(file_fcb)) {
-      free(full_path);
-      return MYFS_FIND_NO_DIR;
-    }
-
-    // we need to check permissions while traversing the tree
-    // user needs to have execute permissions to access the directory entries
-    if (!can_execute(file_fcb, user)) {
-      free(full_path);
-      return MYFS_FIND_NO_ACCESS;
-    }
-
-    // we made sure this is a directory, copy it to dir_entry in case it's
-    // a parent directory of the file we're looking for
+    // the previously loaded file is expected to be a directory, copy it to
+    // dir_fcb in case it's a parent directory of the file we're looking for
     memcpy(dir_fcb, file_fcb, sizeof(struct my_fcb));
 
-    // iterate directory entries
-    struct my_dir_iter iter;
-    iterate_dir_entries(dir_fcb, &iter);
+    // find the entry in the directory and read it into file_fcb
+    // permissions are checked for every directory on the way
+    int result = find_dir_child(dir_fcb, entry_name, user, file_fcb);
 
-    struct my_dir_entry* entry;
-    char found = 0;
+    if (result == MYFS_FIND_NO_FILE) {
+      free(full_path);
+      // check if there were any other components remaining in the path
+      // if yes, it means that we did not find a parent directory
+      // otherwise we didn't find the file (last component of the path)
+      return (path == NULL) ? MYFS_FIND_NO_FILE : MYFS_FIND_NO_DIR;
 
-    // go through the entries until we find a match
-    while ((entry = next_dir_entry(&iter)) != NULL) {
-      if (strcmp(entry_name, entry->name) == 0) {
-        found = 1;
-        break;
-      }
+    } else if (result != MYFS_FIND_FOUND) {
+      // some directory in the path does not exist or cannot be accessed
+      free(full_path);
+      return result;
     }
 
-    // a match is found, read it into file_fcb and get to the next path component
+    // get to the next path component
     // if this was the last component in the path, the while loop will stop and
     // function will return the found file in file_fcb and its parent directory
     // in dir_fcb
-    if (found) {
-      read_file(&(entry->fcb_id), file_fcb);
-      entry_name = path_split(&path);
-    }
-
-    clean_dir_iterator(&iter);
-
-    // if directory entry does not exist...
-    if (!found) {
-      free(full_path);
-      // ... check if there were any other components remaining in the path
-      // if yes, it means that we did not find a parent directory
-      // otherwise we didn't find the file (last component of the path)
-      return (path == NULL) ? MYFS_FIND_NO_FILE : MYFS_FIND_NO_DIR;
-    }
+    entry_name = path_split(&path);
   }
 
   free(full_path);
@@ -1414,18 +4469,6 @@ char has_permission(struct my_fcb* fcb, struct my_user user,
   }
 }
 
-struct my_user get_context_user() {
-  // copy UID and GID from FUSE context into the user struct
-  struct fuse_context* context = fuse_get_context();
-
-  struct my_user user = {
-    .uid = context->uid,
-    .gid = context->gid,
-  };
-
-  return user;
-}
-
 char can_read(struct my_fcb* fcb, struct my_user user) {
   // check user, group or other read permissions as appropriate
   return has_permission(fcb, user, S_IRUSR, S_IRGRP, S_IROTH);
@@ -1455,21 +4498,36 @@ char check_open_flags(struct my_fcb* fcb, struct my_user user, int flags) {
 }
 
 int get_free_file_handle() {
+  int free_fh = -1;
+
+  lock_mutex(&open_files_lock);
+
   // go through open file entries and look for an unused one
   for (int fh = 0; fh < MY_MAX_OPEN_FILES; fh++) {
     if (!open_files[fh].used) {
-      return fh;
+      free_fh = fh;
+      break;
     }
   }
 
-  // no unused entry found, too many files are open
-  return -1;
+  unlock_mutex(&open_files_lock);
+
+  // -1 if no unused entry is found, too many files are open
+  return free_fh;
 }
 
 int get_open_file(int fh, struct my_fcb* fcb) {
+  uuid_t id;
+
+  lock_mutex(&open_files_lock);
+  char used = open_files[fh].used;
+  uuid_copy(id, open_files[fh].id);
+  unlock_mutex(&open_files_lock);
+
   // is the file handle actually valid?
-  if (open_files[fh].used) {
-    read_db_object(open_files[fh].id, fcb, sizeof(struct my_fcb));
+  if (used) {
+    // the FCB is held in the FCB cache while the file is open
+    read_file(&id, fcb);
     return 0;
   } else {
     return -1;
@@ -1477,29 +4535,44 @@ int get_open_file(int fh, struct my_fcb* fcb) {
 }
 
 int add_open_file(struct my_fcb* file) {
+  // the free entry has to be taken before another thread finds it
+  lock_mutex(&open_files_lock);
+
   int fh = get_free_file_handle();
 
   if (fh != -1) {
     // able to open another file, save it's UUID and mark the entry as used
     uuid_copy(open_files[fh].id, file->id);
     open_files[fh].used = 1;
-
-    return fh;
-  } else {
-    // too many files are open
-    return -1;
+    hold_cached_fcb(file);
+    open_files[fh].write_buffer = NULL;
+    open_files[fh].next_read = 0;
+    open_files[fh].readahead = 0;
+    open_files[fh].readahead_end = 0;
   }
+
+  unlock_mutex(&open_files_lock);
+
+  // -1 if too many files are open
+  return fh;
 }
 
 int remove_open_file(int fh) {
   struct my_fcb file;
 
+  // store the data written through the handle before closing it
+  flush_write_buffer(fh);
+
   // find the FCB for the file handle
   if (get_open_file(fh, &file) == 0) {
+    lock_mutex(&open_files_lock);
     open_files[fh].used = 0;
+    release_cached_fcb(file.id);
+    char still_open = is_file_open(&file);
+    unlock_mutex(&open_files_lock);
 
     // the file was removed while it was open, remove it if it isn't open anywhere else
-    if (file.nlink == 0 && !is_file_open(&file)) {
+    if (file.nlink == 0 && !still_open) {
       remove_file(&file);
     }
 
@@ -1510,15 +4583,379 @@ int remove_open_file(int fh) {
 }
 
 char is_file_open(struct my_fcb* file) {
+  char is_open = 0;
+
+  lock_mutex(&open_files_lock);
+
   // go through open file entries and look for one with a matching UUID
   for (int fh = 0; fh < MY_MAX_OPEN_FILES; fh++) {
     if (open_files[fh].used && uuid_compare(open_files[fh].id, file->id) == 0) {
-      return 1;
+      is_open = 1;
+      break;
     }
   }
 
-  // no matching entry found, file is not open
-  return 0;
+  unlock_mutex(&open_files_lock);
+
+  // 0 if no matching entry is found, file is not open
+  return is_open;
+}
+
+/**
+ * @brief Loads a data block into the block cache for the read ahead thread
+ *
+ * The file can be changed or removed since its blocks were queued, so blocks
+ * which are no longer in the database are skipped.
+ *
+ * @param id UUID of the data block
+ * @param read_data Buffer the block is read into before it is cached
+ */
+static void prefetch_block(uuid_t id, void* read_data) {
+  lock_mutex(&block_cache_lock);
+  char is_cached = find_cached_block(id) != NULL;
+  unsigned long changes = block_changes;
+  unlock_mutex(&block_cache_lock);
+
+  // cached blocks do not need to be read again
+  if (is_cached) return;
+
+  // blocks removed meanwhile are not found
+  if (fetch_db_object(id, read_data, MY_BLOCK_SIZE) >= 0) {
+    cache_read_block(id, read_data, changes);
+  }
+}
+
+/**
+ * @brief Loads the blocks of the queued read ahead requests into the block cache
+ * @param arg Not used
+ * @return NULL
+ */
+static void* run_readahead_thread(void* arg) {
+  (void)arg;
+
+  /** @var Buffer the blocks are read into before they are cached */
+  void* read_data = malloc(MY_BLOCK_SIZE);
+
+  pthread_mutex_lock(&(readahead_queue.lock));
+
+  while (readahead_queue.running) {
+    if (readahead_queue.count == 0) {
+      // nothing to do until a request is queued
+      pthread_cond_wait(&(readahead_queue.changed), &(readahead_queue.lock));
+      continue;
+    }
+
+    struct my_readahead_request request = readahead_queue.requests[readahead_queue.head];
+    readahead_queue.head = (readahead_queue.head + 1) % MY_READAHEAD_QUEUE;
+    readahead_queue.count--;
+    readahead_queue.busy = 1;
+
+    // the queue stays unlocked while the blocks are read, so that reads
+    // queueing more requests do not wait for it
+    pthread_mutex_unlock(&(readahead_queue.lock));
+
+    for (int i = 0; i < request.count; i++) {
+      prefetch_block(request.ids[i], read_data);
+    }
+
+    free(request.ids);
+
+    pthread_mutex_lock(&(readahead_queue.lock));
+    readahead_queue.busy = 0;
+    pthread_cond_broadcast(&(readahead_queue.changed));
+  }
+
+  pthread_mutex_unlock(&(readahead_queue.lock));
+  free(read_data);
+
+  return NULL;
+}
+
+void start_readahead_thread() {
+  pthread_mutex_lock(&(readahead_queue.lock));
+  readahead_queue.head = 0;
+  readahead_queue.count = 0;
+  readahead_queue.busy = 0;
+  readahead_queue.running = 1;
+  pthread_mutex_unlock(&(readahead_queue.lock));
+
+  if (pthread_create(&(readahead_queue.thread), NULL, run_readahead_thread, NULL) != 0) {
+    readahead_queue.running = 0;
+  }
+}
+
+void stop_readahead_thread() {
+  if (!readahead_queue.running) return;
+
+  pthread_mutex_lock(&(readahead_queue.lock));
+  readahead_queue.running = 0;
+
+  // drop the requests the thread did not get to
+  while (readahead_queue.count > 0) {
+    free(readahead_queue.requests[readahead_queue.head].ids);
+    readahead_queue.head = (readahead_queue.head + 1) % MY_READAHEAD_QUEUE;
+    readahead_queue.count--;
+  }
+
+  pthread_cond_broadcast(&(readahead_queue.changed));
+  pthread_mutex_unlock(&(readahead_queue.lock));
+
+  pthread_join(readahead_queue.thread, NULL);
+}
+
+void wait_readahead_queue() {
+  pthread_mutex_lock(&(readahead_queue.lock));
+
+  while (readahead_queue.running && (readahead_queue.count > 0 || readahead_queue.busy)) {
+    pthread_cond_wait(&(readahead_queue.changed), &(readahead_queue.lock));
+  }
+
+  pthread_mutex_unlock(&(readahead_queue.lock));
+}
+
+/**
+ * @brief Queues data blocks for the read ahead thread
+ * @param ids UUIDs of the data blocks, freed by the thread once the request is queued
+ * @param count Number of the data blocks
+ * @return 1 if the request was queued, 0 if the thread is not running or the queue is full
+ */
+static char queue_readahead(uuid_t* ids, int count) {
+  pthread_mutex_lock(&(readahead_queue.lock));
+
+  char queued = readahead_queue.running && readahead_queue.count < MY_READAHEAD_QUEUE;
+
+  if (queued) {
+    struct my_readahead_request* request = &(readahead_queue.requests[(readahead_queue.head + readahead_queue.count) % MY_READAHEAD_QUEUE]);
+    request->ids = ids;
+    request->count = count;
+
+    readahead_queue.count++;
+    pthread_cond_broadcast(&(readahead_queue.changed));
+  }
+
+  pthread_mutex_unlock(&(readahead_queue.lock));
+  return queued;
+}
+
+void read_ahead(int fh, struct my_fcb* file_fcb, size_t size, off_t offset, int max_blocks) {
+  // the read ahead state of the handle is updated with the table locked, the
+  // blocks are looked up with it unlocked
+  lock_mutex(&open_files_lock);
+
+  struct my_open_file* file = &(open_files[fh]);
+
+  // do not read ahead more than a half of the cache, the blocks would be
+  // evicted before they are read
+  if (max_blocks > block_cache.capacity / 2) {
+    max_blocks = block_cache.capacity / 2;
+  }
+
+  if (offset == file->next_read && max_blocks > 0) {
+    // sequential read, read ahead more blocks than last time
+    file->readahead = (file->readahead > 0) ? file->readahead * 2 : MY_MIN_READAHEAD_BLOCKS;
+    if (file->readahead > max_blocks) file->readahead = max_blocks;
+  } else {
+    // random read, stop reading ahead
+    file->readahead = 0;
+    file->readahead_end = 0;
+  }
+
+  file->next_read = offset + size;
+
+  if (file->readahead == 0) {
+    unlock_mutex(&open_files_lock);
+    return;
+  }
+
+  int first_block, last_block;
+  get_block_indexes(size, offset, &first_block, &last_block);
+
+  /** @var First block to read ahead, blocks read ahead before are skipped */
+  int first = (file->readahead_end > last_block) ? file->readahead_end : last_block + 1;
+  /** @var Last block to read ahead, limited by the file size */
+  int last = get_num_blocks(file_fcb->size) - 1;
+  // compared as a difference, the sum can overflow near the last block
+  if (last - last_block > file->readahead) last = last_block + file->readahead;
+
+  unlock_mutex(&open_files_lock);
+
+  if (first > last) return;
+
+  // the blocks are looked up here, the thread does not know whether the
+  // extents are being changed
+  uuid_t* ids = malloc((last - first + 1) * sizeof(uuid_t));
+  int count = 0;
+
+  struct my_extent_map map;
+  open_extents(file_fcb, &map);
+
+  for (int block = first; block <= last; block++) {
+    get_block_id(&map, block, ids[count]);
+
+    // holes are not stored
+    if (!uuid_is_null(ids[count])) count++;
+  }
+
+  close_extents(&map);
+
+  lock_mutex(&open_files_lock);
+
+  // blocks of a dropped request are read ahead again by the next read
+  if (queue_readahead(ids, count)) {
+    file->readahead_end = last + 1;
+  } else {
+    free(ids);
+  }
+
+  unlock_mutex(&open_files_lock);
+}
+
+char buffer_file_write(int fh, const void* buffer, size_t size, off_t offset) {
+  // the caller holds the write lock of the file, so only writes to other
+  // files can wait for the buffers of this one to be flushed
+  lock_mutex(&open_files_lock);
+
+  // make sure other handles do not hold older data for the same range
+  if (num_write_buffers > 0) {
+    for (int other_fh = 0; other_fh < MY_MAX_OPEN_FILES; other_fh++) {
+      if (other_fh != fh && open_files[other_fh].used && open_files[other_fh].write_buffer != NULL &&
+          uuid_compare(open_files[other_fh].id, open_files[fh].id) == 0) {
+        flush_write_buffer(other_fh);
+      }
+    }
+  }
+
+  int first_block, last_block;
+  get_block_indexes(size, offset, &first_block, &last_block);
+
+  /** @var Offset in the block of the first written byte */
+  int start = offset - (off_t)first_block * MY_BLOCK_SIZE;
+  /** @var Offset in the block after the last written byte */
+  int end = start + size;
+
+  struct my_write_buffer* write_buffer = open_files[fh].write_buffer;
+
+  // the buffer can only be extended by writes to the same block that
+  // overlap or directly follow the buffered range
+  if (write_buffer != NULL && (
+    write_buffer->block != first_block ||
+    start > write_buffer->end ||
+    end < write_buffer->start
+  )) {
+    flush_write_buffer(fh);
+    write_buffer = NULL;
+  }
+
+  // whole blocks and writes spanning more blocks are written directly
+  if (size >= MY_BLOCK_SIZE || first_block != last_block) {
+    flush_write_buffer(fh);
+    unlock_mutex(&open_files_lock);
+    return 0;
+  }
+
+  if (write_buffer == NULL) {
+    // do not use too much memory for buffers
+    if (num_write_buffers >= MY_MAX_WRITE_BUFFERS) {
+      unlock_mutex(&open_files_lock);
+      return 0;
+    }
+
+    write_buffer = malloc(sizeof(struct my_write_buffer));
+    write_buffer->block = first_block;
+    write_buffer->start = start;
+    write_buffer->end = end;
+
+    open_files[fh].write_buffer = write_buffer;
+    num_write_buffers++;
+  }
+
+  // copy the data into the buffer and extend the buffered range
+  memcpy(write_buffer->data + start, buffer, size);
+  if (start < write_buffer->start) write_buffer->start = start;
+  if (end > write_buffer->end) write_buffer->end = end;
+
+  // the rest of the block has been written, there is nothing more to collect
+  if (write_buffer->end == MY_BLOCK_SIZE) {
+    flush_write_buffer(fh);
+  }
+
+  unlock_mutex(&open_files_lock);
+  return 1;
+}
+
+void flush_write_buffer(int fh) {
+  // take the buffer from the handle, it is written with the table unlocked
+  // unless the caller holds the lock
+  lock_mutex(&open_files_lock);
+
+  struct my_write_buffer* write_buffer = open_files[fh].write_buffer;
+
+  if (write_buffer != NULL) {
+    open_files[fh].write_buffer = NULL;
+    num_write_buffers--;
+  }
+
+  unlock_mutex(&open_files_lock);
+
+  if (write_buffer == NULL) return;
+
+  // write the buffered range into the file, this also updates its size
+  struct my_fcb file_fcb;
+  get_open_file(fh, &file_fcb);
+
+  write_file_data(&file_fcb, write_buffer->data + write_buffer->start,
+    write_buffer->end - write_buffer->start,
+    (off_t)write_buffer->block * MY_BLOCK_SIZE + write_buffer->start);
+
+  free(write_buffer);
+}
+
+/**
+ * @brief Checks whether a handle has buffered writes for the file
+ * @param fh File handle
+ * @param id UUID of the FCB of the file
+ * @return 1 if the handle belongs to the file and has a write buffer, 0 otherwise
+ */
+static char is_handle_buffered(int fh, uuid_t id) {
+  lock_mutex(&open_files_lock);
+
+  char buffered = open_files[fh].used && open_files[fh].write_buffer != NULL &&
+    uuid_compare(open_files[fh].id, id) == 0;
+
+  unlock_mutex(&open_files_lock);
+  return buffered;
+}
+
+char has_file_buffers(uuid_t id) {
+  lock_mutex(&open_files_lock);
+
+  // nothing is buffered, no need to look for the file handles
+  char buffered = 0;
+
+  for (int fh = 0; num_write_buffers > 0 && fh < MY_MAX_OPEN_FILES && !buffered; fh++) {
+    buffered = is_handle_buffered(fh, id);
+  }
+
+  unlock_mutex(&open_files_lock);
+  return buffered;
+}
+
+int flush_file_buffers(uuid_t id) {
+  int flushed = 0;
+
+  // nothing is buffered, no need to look for the file handles
+  if (!has_file_buffers(id)) return 0;
+
+  // the handles are checked one by one, the table is not locked while the
+  // buffers are written
+  for (int fh = 0; fh < MY_MAX_OPEN_FILES; fh++) {
+    if (is_handle_buffered(fh, id)) {
+      flush_write_buffer(fh);
+      flushed++;
+    }
+  }
+
+  return flushed;
 }
 
 // Initialise the in-memory data structures from the store. If the root object (from the store) is empty then create a root fcb (directory)
@@ -1530,6 +4967,14 @@ void init_fs(){
   // Initialise the store.
   init_store();
 
+  // the database is relative to the working directory, which changes when
+  // the process becomes a daemon
+  store_dir = open(".", O_RDONLY);
+
+  // operations are committed in groups, closing the database must not commit
+  // a part of an operation
+  unqlite_config(pDb, UNQLITE_CONFIG_DISABLE_AUTO_COMMIT);
+
   if (root_is_empty) {
     printf("init_fs: root is empty\n");
 
@@ -1560,24 +5005,101 @@ void init_fs(){
        error_handler(rc);
     }
   }
+
+  // every lookup starts at the root, keep it in memory
+  pin_root_fcb();
+
+  // the kernel knows the root directory by inode number 1
+  init_inode_table(root_object.id);
+
+  // make the created root directory durable before serving any requests
+  commit_db();
 }
 
 void shutdown_fs(){
+  write_log("shutdown_fs: block cache hits %lu, misses %lu\n", block_cache.hits, block_cache.misses);
+  clean_block_cache();
+
+  write_log("shutdown_fs: FCB cache hits %lu, misses %lu\n", fcb_cache.hits, fcb_cache.misses);
+  clean_fcb_cache();
+
+  write_log("shutdown_fs: dentry cache hits %lu, misses %lu\n", dentry_cache.hits, dentry_cache.misses);
+  clean_dentry_cache();
+
+  clean_inode_table();
+
+  // the remaining finished operations would be rolled back when closing
+  commit_db();
+  write_log("shutdown_fs: %lu commits\n", group_commit.commits);
+
+  if (store_dir >= 0) {
+    close(store_dir);
+  }
+
   unqlite_close(pDb);
 }
 
 int main(int argc, char *argv[]){
-  int fuserc;
+  int fuserc = 1;
   struct myfs_state *myfs_internal_state;
 
   //Setup the log file and store the FILE* in the private data object for the file system.
   myfs_internal_state = malloc(sizeof(struct myfs_state));
   myfs_internal_state->logfile = init_log_file();
 
+  //Read our mount options, the rest of the arguments is passed to fuse.
+  struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+  if (fuse_opt_parse(&args, &options, myfs_opts, NULL) == -1) {
+    return 1;
+  }
+
+  //Read the mount point, whether to handle requests in several threads and
+  //whether to stay in the foreground.
+  char* mountpoint;
+  int multithreaded;
+  int foreground;
+  if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) == -1) {
+    return 1;
+  }
+
+  init_block_cache(options.cache_blocks > 0 ? options.cache_blocks : 0);
+  init_fcb_cache(options.cache_fcbs > 0 ? options.cache_fcbs : 0);
+  init_dentry_cache(options.cache_dentries > 0 ? options.cache_dentries : 0);
+  init_group_commit(options.commit_ops, options.commit_interval);
+
   //Initialise the file system. This is being done outside of fuse for ease of debugging.
   init_fs();
 
-  fuserc = fuse_main(argc, argv, &myfs_oper, myfs_internal_state);
+  //Mount the file system and handle requests until it is unmounted. Requests
+  //are handled by several threads unless -s is given.
+  struct fuse_chan* channel = fuse_mount(mountpoint, &args);
+
+  if (channel != NULL) {
+    struct fuse_session* session = fuse_lowlevel_new(&args, &myfs_oper, sizeof(myfs_oper), myfs_internal_state);
+
+    if (session != NULL && (foreground || daemon(0, 0) == 0)) {
+      if (fuse_set_signal_handlers(session) != -1) {
+        fuse_session_add_chan(session, channel);
+        //The threads are started after daemon, which would not copy them.
+        start_commit_thread();
+        start_readahead_thread();
+        fuserc = multithreaded ? fuse_session_loop_mt(session) : fuse_session_loop(session);
+        stop_readahead_thread();
+        stop_commit_thread();
+        fuse_remove_signal_handlers(session);
+        fuse_session_remove_chan(channel);
+      }
+    }
+
+    if (session != NULL) {
+      fuse_session_destroy(session);
+    }
+
+    fuse_unmount(mountpoint, channel);
+  }
+
+  free(mountpoint);
+  fuse_opt_free_args(&args);
 
   //Shutdown the file system.
   shutdown_fs();
@@ -1,16 +1,43 @@
 #include "fs.h"
+#include <limits.h>
+#include <pthread.h>
+#include <sys/statvfs.h>
 
 #define MY_MAX_PATH 256
 #define MY_BLOCK_SIZE 16384
-#define MY_MAX_BLOCKS 65536
+#define MY_INLINE_SIZE 2048
+#define MY_FCB_EXTENTS (int)(MY_INLINE_SIZE / sizeof(struct my_extent))
+#define MY_MAX_BLOCKS INT_MAX
 #define MY_MAX_OPEN_FILES 1000
-#define MY_MAX_FILE_SIZE MY_MAX_BLOCKS*MY_BLOCK_SIZE
+#define MY_DIR_NODE_SIZE 4096
+#define MY_DIR_ENTRY_ALIGN 4
+#define MY_DEFAULT_CACHE_BLOCKS 256
+#define MY_DEFAULT_CACHE_FCBS 1024
+#define MY_DEFAULT_CACHE_DENTRIES 4096
+#define MY_MAX_WRITE_BUFFERS 64
+#define MY_MIN_READAHEAD_BLOCKS 2
+#define MY_DEFAULT_READAHEAD_BLOCKS 32
+#define MY_READAHEAD_QUEUE 64
+#define MY_MAX_FILE_SIZE ((off_t)MY_MAX_BLOCKS * MY_BLOCK_SIZE)
+#define MY_MIN_INODES 1024
+#define MY_FCB_LOCK_BUCKETS 1024
+#define MY_UNKNOWN_INO 0xffffffff
+#define MY_ATTR_TIMEOUT 1.0
+#define MY_DEFAULT_COMMIT_OPS 256
+#define MY_DEFAULT_COMMIT_INTERVAL 5
 
 #define MYFS_FIND_FOUND 0
 #define MYFS_FIND_NO_DIR -1
 #define MYFS_FIND_NO_FILE -2
 #define MYFS_FIND_NO_ACCESS -3
 
+/** @brief Run of consecutive data blocks with keys derived from one base UUID */
+struct my_extent {
+  int start; /**< Index of the first block in the file */
+  int length; /**< Number of blocks */
+  uuid_t base; /**< UUID of the first block, the last 4 bytes hold the block offset in the extent */
+};
+
 /** @brief File control block */
 struct my_fcb {
   uuid_t id; /**< File UUID */
@@ -22,32 +49,130 @@ struct my_fcb {
   time_t ctime; /**< Time of last change to meta-data (status) */
   nlink_t nlink; /**< Number of hard links */
   off_t size; /**< File data size */
-  uuid_t data; /**< Index block UUID */
+  int num_extents; /**< Number of extents mapping the data blocks */
+  uuid_t extent_list; /**< UUID of the extent tree root if there are more than MY_FCB_EXTENTS, null otherwise */
+  union {
+    char inline_data[MY_INLINE_SIZE]; /**< Data of files not larger than MY_INLINE_SIZE, only size bytes are stored */
+    struct my_extent extents[MY_FCB_EXTENTS]; /**< Extents of larger files, only num_extents are stored */
+  };
 };
 
-/** @brief Index block */
-struct my_index {
-  uuid_t entries[MY_MAX_BLOCKS]; /**< Array of data block UUIDs */
+#define MY_EXTENT_NODE_SIZE 4096
+#define MY_EXTENT_NODE_EXTENTS (int)((MY_EXTENT_NODE_SIZE - 2 * sizeof(int)) / sizeof(struct my_extent))
+#define MY_EXTENT_MAX_DEPTH 8
+
+/**
+ * @brief Node of the extent tree of a file with more than MY_FCB_EXTENTS extents
+ *
+ * Leaves hold extents sorted by their first block. Records of inner nodes
+ * are extents too, start is the first block of the first extent in the child
+ * and base is the UUID of the child node.
+ */
+struct my_extent_node {
+  int leaf; /**< Boolean, whether the node is a leaf */
+  int count; /**< Number of extents or children, only these are stored */
+  struct my_extent extents[MY_EXTENT_NODE_EXTENTS + 1]; /**< Extents or children, with space for one more before the node is split */
 };
 
-/** @brief Directory header */
-struct my_dir_header {
-  int items; /**< Number of entries in the directory */
-  int first_free; /**< Offset of the first unused entry, if no unused entry */
+/**
+ * @brief Extents of a file loaded into memory
+ *
+ * Extents in the FCB are copied into the map. Of the extent tree, only the
+ * nodes on the path to the leaf with the last looked up block are loaded.
+ */
+struct my_extent_map {
+  struct my_fcb* fcb; /**< FCB of the file, holds the extents or the UUID of the extent tree root */
+  int total; /**< Number of extents of the file */
+  struct my_extent* extents; /**< Extents of the current leaf, or the extents from the FCB, sorted by their first block */
+  int count; /**< Number of extents in the array */
+  int last; /**< Index of the last extent found, where sequential lookups start */
+  char dirty; /**< Whether the extents in the FCB or their number were changed */
+  struct my_extent fcb_extents[MY_FCB_EXTENTS + 1]; /**< Extents from the FCB, with space for one more before they are moved to a tree */
+  int depth; /**< Number of loaded tree nodes, 0 if the root is not loaded */
+  struct my_extent_node* nodes[MY_EXTENT_MAX_DEPTH]; /**< Loaded nodes from the root to the current leaf */
+  uuid_t ids[MY_EXTENT_MAX_DEPTH]; /**< UUIDs of the loaded nodes */
+  int positions[MY_EXTENT_MAX_DEPTH]; /**< Position of the next loaded node in each loaded inner node */
+  char changed[MY_EXTENT_MAX_DEPTH]; /**< Whether each loaded node was changed */
+  int low; /**< First block the extents of the current leaf can cover */
+  int high; /**< Block after the last one the extents of the current leaf can cover */
 };
 
-/** @bried Directory entry */
+/**
+ * @brief Directory entry
+ *
+ * Entries are packed one after another in the directory data, only the name
+ * bytes up to the terminating null are stored, rounded up to MY_DIR_ENTRY_ALIGN.
+ */
 struct my_dir_entry {
-  char name[MY_MAX_PATH]; /**< Entry name */
-  uuid_t fcb_id; /**< UUID of the FCB for the entry file **/
-  int next_free; /**< Offset of the next unused entry, if no next entry */
+  union {
+    uuid_t fcb_id; /**< UUID of the FCB for the entry file **/
+    int next_free; /**< Offset of the next unused entry of the same size, -1 if there is none */
+  };
+  unsigned short size; /**< Size of the stored entry in bytes */
   char used; /**< Whether this entry is used */
+  char name[MY_MAX_PATH]; /**< Entry name */
+};
+
+#define MY_DIR_FREE_LISTS (int)(sizeof(struct my_dir_entry) / MY_DIR_ENTRY_ALIGN + 1)
+
+/** @brief Directory header */
+struct my_dir_header {
+  int free_lists[MY_DIR_FREE_LISTS]; /**< Offsets of the first unused entry of each size divided by MY_DIR_ENTRY_ALIGN, -1 if none */
+  int num_entries; /**< Number of used entries */
+  uuid_t index_id; /**< Base UUID of the index B+tree nodes, null if the directory is not indexed */
+  int index_root; /**< Number of the root node of the index */
+  int index_nodes; /**< Number of allocated index nodes, including the free ones */
+  int index_free; /**< Number of the first free index node, -1 if there is none */
+};
+
+/**
+ * @brief Key of a directory entry
+ *
+ * Entries are ordered by the hash of their name and then by their offset,
+ * which tells apart entries with the same hash. Entries never move in the
+ * directory data, so the key of an entry does not change while it exists.
+ */
+struct my_dir_key {
+  unsigned int hash; /**< Hash of the entry name */
+  int offset; /**< Offset of the entry in the directory data */
+};
+
+/** @brief Record of a directory index node */
+struct my_dir_record {
+  struct my_dir_key key; /**< Key of the entry in leaves, the first key of the child in inner nodes */
+  int child; /**< Number of the child node with keys starting from the key, not used in leaves */
+};
+
+#define MY_DIR_NODE_RECORDS (int)((MY_DIR_NODE_SIZE - 3 * sizeof(int)) / sizeof(struct my_dir_record))
+#define MY_DIR_NODE_MIN (MY_DIR_NODE_RECORDS / 4)
+
+/**
+ * @brief Node of a directory index B+tree
+ *
+ * Records are sorted by key. Nodes with less than MY_DIR_NODE_MIN records
+ * are merged with a sibling or take records from it, free nodes are linked
+ * in a list and reused by later splits.
+ */
+struct my_dir_node {
+  char leaf; /**< Whether the node is a leaf */
+  int count; /**< Number of records in the node */
+  int link; /**< Next leaf or next free node, -1 if there is none, or the child of an inner node with keys before the first record */
+  struct my_dir_record records[MY_DIR_NODE_RECORDS + 1]; /**< Records, with space for one more before the node is split */
 };
 
 /** @brief Struct used when iterating directories to hold iterator state */
 struct my_dir_iter {
-  int position; /**< Offset of the current entry */
-  void* dir_data; /**< Pointer to raw directory data */
+  struct my_fcb* dir_fcb; /**< FCB of the iterated directory */
+  uuid_t index_id; /**< Base UUID of the index nodes, null if the directory is small */
+  int index_root; /**< Number of the root node of the index */
+  int position; /**< Index of the next key of a small directory, or of the next record in the leaf */
+  int count; /**< Number of keys of a small directory */
+  struct my_dir_key* keys; /**< Sorted keys of the used entries of a small directory */
+  void* dir_data; /**< Pointer to raw data of a small directory */
+  struct my_dir_node* node; /**< Current leaf of an indexed directory, NULL if it is not loaded yet */
+  off_t cookie; /**< Cookie of the last returned entry, 0 at the start */
+  int offset; /**< Offset of the last returned entry */
+  struct my_dir_entry entry; /**< Last returned entry of an indexed directory */
 };
 
 /** @brief Helper struct for storing user and group IDs for various functions */
@@ -56,10 +181,142 @@ struct my_user {
   gid_t  gid; /**< Group ID */
 };
 
+/** @brief Links of a cached entry in the hash table and the LRU list of its cache, the first member of every cached entry */
+struct my_cache_entry {
+  unsigned int hash; /**< Hash of the entry key */
+  struct my_cache_entry* hash_next; /**< Next entry in the same hash bucket */
+  struct my_cache_entry* lru_prev; /**< Previous, more recently used entry */
+  struct my_cache_entry* lru_next; /**< Next, less recently used entry */
+};
+
+/** @brief Bounded hash table of cached entries, least recently used entries are evicted */
+struct my_cache {
+  int capacity; /**< Maximum number of cached entries, 0 disables the cache */
+  int size; /**< Number of cached entries */
+  struct my_cache_entry** buckets; /**< Hash table of cached entries, one bucket per entry */
+  struct my_cache_entry* lru_first; /**< Most recently used entry */
+  struct my_cache_entry* lru_last; /**< Least recently used entry */
+  unsigned long hits; /**< Number of lookups that found the entry */
+  unsigned long misses; /**< Number of lookups that did not find the entry */
+};
+
+/** @brief Copy of a data block kept in the block cache */
+struct my_cached_block {
+  struct my_cache_entry entry; /**< Links in the block cache */
+  uuid_t id; /**< UUID of the data block */
+  char data[MY_BLOCK_SIZE]; /**< Block data */
+};
+
+/** @brief Copy of a FCB kept in the FCB cache, referenced FCBs are not evicted */
+struct my_cached_fcb {
+  struct my_cache_entry entry; /**< Links in the FCB cache */
+  int refs; /**< Number of open file handles using the FCB */
+  struct my_fcb fcb; /**< FCB as it is stored in the database */
+};
+
+/** @brief Result of looking up a name in a directory, kept in the dentry cache */
+struct my_dentry {
+  struct my_cache_entry entry; /**< Links in the dentry cache */
+  uuid_t dir_id; /**< UUID of the FCB of the directory */
+  char name[MY_MAX_PATH]; /**< Entry name */
+  uuid_t fcb_id; /**< UUID of the FCB of the entry file, null if there is no such entry */
+};
+
+/** @brief Name in a directory a dentry is looked up by */
+struct my_dentry_key {
+  unsigned char* dir_id; /**< UUID of the FCB of the directory */
+  const char* name; /**< Entry name */
+};
+
+/** @brief Inode number handed to the kernel for a FCB */
+struct my_inode {
+  uuid_t id; /**< UUID of the FCB, null if the inode is free */
+  unsigned long lookups; /**< Number of lookups the kernel has not forgotten yet */
+  unsigned long generation; /**< Incremented every time the inode number is reused */
+  unsigned long data_commit; /**< Number of commits after which the file data is durable */
+  int next; /**< Index of the next inode in the same hash bucket or in the free list, -1 at the end */
+};
+
+/** @brief Maps inode numbers used by the kernel to FCB UUIDs and back */
+struct my_inode_table {
+  int capacity; /**< Number of allocated inodes, grows when all of them are used */
+  struct my_inode* inodes; /**< Inodes, the inode number is the array index plus one */
+  int* buckets; /**< Hash table of used inodes by UUID, one bucket per inode, -1 if empty */
+  int free; /**< Index of the first free inode, -1 if there is none */
+};
+
+/** @brief Reader/writer lock of one FCB, it exists while some thread holds or waits for it */
+struct my_fcb_lock {
+  uuid_t id; /**< UUID of the FCB */
+  pthread_rwlock_t lock; /**< Lock of the FCB and its data */
+  int refs; /**< Number of threads holding or waiting for the lock */
+  struct my_fcb_lock* next; /**< Next lock in the same hash bucket */
+};
+
+/** @brief Options which can be set when mounting the file system */
+struct my_options {
+  int cache_blocks; /**< Number of data blocks kept in the block cache */
+  int cache_fcbs; /**< Number of FCBs kept in the FCB cache */
+  int cache_dentries; /**< Number of directory lookups kept in the dentry cache */
+  int readahead_blocks; /**< Maximum number of data blocks read ahead for sequential reads */
+  int commit_ops; /**< Number of operations committed to the database together */
+  int commit_interval; /**< Maximum number of seconds before finished operations are committed */
+};
+
+/**
+ * @brief Operations which change the database and are committed to it together
+ *
+ * A commit is only made when no operation is in progress, so that the
+ * database never contains half of an operation.
+ */
+struct my_group_commit {
+  int max_ops; /**< Number of finished operations which triggers a commit, 1 commits every operation */
+  int interval; /**< Maximum number of seconds finished operations wait for a commit, 0 for no limit */
+  int active; /**< Number of operations in progress */
+  int pending; /**< Number of finished operations waiting for a commit */
+  time_t first_pending; /**< Time when the first of the pending operations finished */
+  char wanted; /**< Boolean, set when a commit is due, new operations wait until it is made */
+  char running; /**< Boolean, set while the commit thread is running */
+  unsigned long commits; /**< Number of commits made */
+  pthread_mutex_t lock; /**< Protects the fields above */
+  pthread_cond_t changed; /**< Signalled when an operation finishes or a commit is made */
+  pthread_t thread; /**< Thread committing the operations when the interval runs out */
+};
+
+/** @brief Data written through an open file, but not stored in the database yet */
+struct my_write_buffer {
+  int block; /**< Index of the buffered block in the file */
+  int start; /**< Offset in the block of the first buffered byte */
+  int end; /**< Offset in the block after the last buffered byte */
+  char data[MY_BLOCK_SIZE]; /**< Block data, only the range from start to end is valid */
+};
+
 /** @brief Keeps track of one open file */
 struct my_open_file {
   uuid_t id; /**< ID of the FCB of the open file */
   char used; /**< Boolean variable for checking if this entry is used */
+  struct my_write_buffer* write_buffer; /**< Buffered writes, or NULL if there are none */
+  off_t next_read; /**< Offset after the last read, a read from here is sequential */
+  int readahead; /**< Number of blocks to read ahead, 0 if reads are not sequential */
+  int readahead_end; /**< Index of the block after the last block read ahead */
+};
+
+/** @brief Data blocks of a file waiting to be read ahead */
+struct my_readahead_request {
+  uuid_t* ids; /**< UUIDs of the data blocks, allocated by read_ahead and freed by the read ahead thread */
+  int count; /**< Number of the data blocks */
+};
+
+/** @brief Queue of read ahead requests, the read ahead thread loads their blocks into the block cache */
+struct my_readahead_queue {
+  struct my_readahead_request requests[MY_READAHEAD_QUEUE]; /**< Ring buffer of the queued requests */
+  int head; /**< Index of the oldest queued request */
+  int count; /**< Number of queued requests */
+  char busy; /**< Boolean, set while the thread is loading the blocks of a request */
+  char running; /**< Boolean, set while the read ahead thread is running */
+  pthread_mutex_t lock; /**< Protects the fields above */
+  pthread_cond_t changed; /**< Signalled when a request is queued or finished */
+  pthread_t thread; /**< Thread loading the requested blocks */
 };
 
 /**
@@ -73,6 +330,46 @@ struct my_open_file {
  */
 void read_db_object(uuid_t, void*, size_t);
 
+/**
+ * @brief Reads an object from the database if it exists, with a single lookup
+ *
+ * At most size bytes are stored in the buffer, the rest of a longer object
+ * is skipped. In case of an error the program is terminated and error is printed
+ *
+ * @param id UUID to be used as the key
+ * @param buffer Buffer to store the loaded object
+ * @param size Size of the buffer
+ * @return Size of the stored object, or -1 if it does not exist
+ */
+long fetch_db_object(uuid_t, void*, size_t);
+
+/**
+ * @brief Passes an object from the database to a callback if it exists
+ *
+ * The callback gets consecutive chunks of the object straight from the
+ * database pages and returns UNQLITE_OK to continue. In case of an error
+ * the program is terminated and error is printed
+ *
+ * @param id UUID to be used as the key
+ * @param consumer Callback for the chunks, NULL to only look the object up
+ * @param user_data Last argument of the callback
+ * @return 1 if the object exists, 0 otherwise
+ */
+char fetch_db_object_chunks(uuid_t, int (*)(const void*, unsigned int, void*), void*);
+
+/**
+ * @brief Reads a part of an object from the database straight into the buffer
+ *
+ * Only the requested range is copied, the object is not loaded into memory
+ * as a whole. In case of an error the program is terminated and error is printed
+ *
+ * @param id UUID to be used as the key
+ * @param buffer Buffer to store the range
+ * @param size Size of the range
+ * @param offset Offset of the range in the object
+ */
+void read_db_object_range(uuid_t, void*, size_t, off_t);
+
 /**
  * @brief Writes an object to the database using the UUID as the key
  *
@@ -100,6 +397,439 @@ void delete_db_object(uuid_t);
  */
 char has_db_object(uuid_t);
 
+/**
+ * @brief Changes the usage counters in the root object
+ *
+ * The root object is written to the database with the next commit.
+ *
+ * @param blocks Change in the number of data blocks in use
+ * @param files Change in the number of files and directories
+ */
+void change_usage(long long, long long);
+
+/**
+ * @brief Fills in the file system statistics from the usage counters
+ *
+ * Free space is the space available to the database on the file system it is
+ * stored on, the database itself has no fixed size.
+ *
+ * @param stbuf Pointer to the statistics
+ */
+void get_usage_stat(struct statvfs*);
+
+/** @brief Group commit of the database operations */
+extern struct my_group_commit group_commit;
+
+/**
+ * @brief Sets up the group commit
+ *
+ * Automatic commits of UnQLite have to be disabled by the caller, otherwise
+ * closing the database commits the operations which were not finished.
+ *
+ * @param max_ops Number of finished operations which triggers a commit, 1 or less commits every operation
+ * @param interval Maximum number of seconds finished operations wait for a commit, 0 or less for no limit
+ */
+void init_group_commit(int, int);
+
+/**
+ * @brief Marks the start of an operation which can change the database
+ *
+ * Waits if a commit is due, so that the operations in progress can finish
+ * and be committed. Must be called before any FCB is locked.
+ */
+void begin_db_operation();
+
+/**
+ * @brief Marks the end of an operation started by begin_db_operation
+ *
+ * The last operation to finish makes the commit if one is due. Must be called
+ * after all FCB locks are released.
+ */
+void end_db_operation();
+
+/**
+ * @brief Makes the operations finished before the call durable
+ *
+ * If some of them are not committed yet, a commit is requested and the call
+ * waits until it is made. Must not be called inside an operation.
+ */
+void sync_db();
+
+/**
+ * @brief Commits all finished operations to the database now
+ *
+ * Waits for the operations in progress to finish first, so it must not be
+ * called inside an operation.
+ */
+void commit_db();
+
+/**
+ * @brief Starts the thread which commits finished operations after the commit interval
+ */
+void start_commit_thread();
+
+/**
+ * @brief Stops the commit thread, finished operations are committed by commit_db afterwards
+ */
+void stop_commit_thread();
+
+/**
+ * @brief Loads the extents mapping the data blocks of a file
+ *
+ * The map has to be passed to close_extents when it is no longer needed.
+ * Changes to the extents are saved in the FCB, which then needs to be
+ * written with update_file. Nodes of an extent tree are only read when
+ * blocks they map are looked up.
+ *
+ * @param fcb Pointer to the FCB of the file
+ * @param map Pointer to the previously allocated map
+ */
+void open_extents(struct my_fcb*, struct my_extent_map*);
+
+/**
+ * @brief Looks up the UUID of a data block
+ * @param map Pointer to the extent map
+ * @param block Index of the block in the file
+ * @param id UUID of the data block, cleared if the block is a hole
+ */
+void get_block_id(struct my_extent_map*, int, uuid_t);
+
+/**
+ * @brief Maps a hole to a new data block
+ *
+ * The extent ending right before the block is extended if there is one,
+ * so that consecutive blocks get consecutive keys. The data block itself
+ * has to be written by the caller.
+ *
+ * @param map Pointer to the extent map
+ * @param block Index of the block in the file, has to be a hole
+ * @param id UUID of the new data block
+ */
+void allocate_block(struct my_extent_map*, int, uuid_t);
+
+/**
+ * @brief Deletes all data blocks after the first blocks and removes them from the map
+ * @param map Pointer to the extent map
+ * @param num_blocks Number of blocks that remain in the file
+ */
+void free_blocks(struct my_extent_map*, int);
+
+/**
+ * @brief Saves changed extents and deallocates the map
+ *
+ * Up to MY_FCB_EXTENTS extents are kept in the FCB, more are kept in a tree
+ * of extent nodes, of which only the changed ones are written.
+ *
+ * @param map Pointer to the extent map
+ */
+void close_extents(struct my_extent_map*);
+
+/**
+ * @brief Initialises an empty cache
+ * @param cache Pointer to the cache
+ * @param capacity Maximum number of cached entries, 0 disables the cache
+ */
+void init_cache(struct my_cache*, int);
+
+/**
+ * @brief Finds an entry in a cache without changing the LRU list
+ *
+ * The caller has to hold the lock of the cache.
+ *
+ * @param cache Pointer to the cache
+ * @param hash Hash of the key
+ * @param match Function telling whether an entry has the key
+ * @param key Pointer to the key, passed to the match function
+ * @return Pointer to the entry, or NULL if it is not cached
+ */
+struct my_cache_entry* find_cache_entry(struct my_cache*, unsigned int, char (*)(struct my_cache_entry*, const void*), const void*);
+
+/**
+ * @brief Looks up an entry in a cache, counting the hits and misses
+ *
+ * Found entry becomes the most recently used one. The caller has to hold the
+ * lock of the cache.
+ *
+ * @param cache Pointer to the cache
+ * @param hash Hash of the key
+ * @param match Function telling whether an entry has the key
+ * @param key Pointer to the key, passed to the match function
+ * @return Pointer to the entry, or NULL if it is not cached
+ */
+struct my_cache_entry* lookup_cache_entry(struct my_cache*, unsigned int, char (*)(struct my_cache_entry*, const void*), const void*);
+
+/**
+ * @brief Adds an entry to a cache as the most recently used one
+ *
+ * The key must not be cached yet. Nothing is evicted, the caller makes space
+ * with remove_cache_entry first.
+ *
+ * @param cache Pointer to the cache
+ * @param entry Pointer to the entry
+ * @param hash Hash of the entry key
+ */
+void add_cache_entry(struct my_cache*, struct my_cache_entry*, unsigned int);
+
+/**
+ * @brief Makes a cached entry the most recently used one
+ * @param cache Pointer to the cache
+ * @param entry Pointer to the entry
+ */
+void touch_cache_entry(struct my_cache*, struct my_cache_entry*);
+
+/**
+ * @brief Removes an entry from a cache, the caller frees or reuses it
+ * @param cache Pointer to the cache
+ * @param entry Pointer to the entry
+ */
+void remove_cache_entry(struct my_cache*, struct my_cache_entry*);
+
+/**
+ * @brief Frees all entries of a cache and disables it
+ * @param cache Pointer to the cache
+ */
+void clean_cache(struct my_cache*);
+
+/** @brief Block cache shared by all files */
+extern struct my_cache block_cache;
+
+/**
+ * @brief Allocates the block cache
+ * @param capacity Maximum number of cached blocks, 0 disables the cache
+ */
+void init_block_cache(int);
+
+/**
+ * @brief Looks up a data block in the block cache
+ *
+ * Found block becomes the most recently used one. The block cache lock has to
+ * be held while the returned data is used, otherwise it can be evicted.
+ *
+ * @param id UUID of the data block
+ * @return Pointer to the cached block data, or NULL if the block is not cached
+ */
+void* get_cached_block(uuid_t);
+
+/**
+ * @brief Adds a data block to the block cache
+ *
+ * If the cache is full, the least recently used block is evicted and its
+ * memory reused. The returned buffer has to be filled by the caller while it
+ * holds the block cache lock.
+ *
+ * @param id UUID of the data block
+ * @return Pointer to the data of the cached block, or NULL if the cache is disabled
+ */
+void* add_cached_block(uuid_t);
+
+/**
+ * @brief Removes a data block from the block cache if it is cached
+ * @param id UUID of the data block
+ */
+void remove_cached_block(uuid_t);
+
+/**
+ * @brief Deallocates all blocks in the block cache
+ */
+void clean_block_cache();
+
+/** @brief FCB cache shared by all files */
+extern struct my_cache fcb_cache;
+
+/**
+ * @brief Allocates the FCB cache
+ * @param capacity Maximum number of cached FCBs, 0 disables the cache
+ */
+void init_fcb_cache(int);
+
+/**
+ * @brief Looks up a FCB in the FCB cache
+ *
+ * Found FCB becomes the most recently used one. The cached copy must not be
+ * changed, use update_file instead, and it can only be used while the FCB
+ * cache lock is held.
+ *
+ * @param id UUID of the FCB
+ * @return Pointer to the cached FCB, or NULL if the FCB is not cached
+ */
+struct my_fcb* get_cached_fcb(uuid_t);
+
+/**
+ * @brief Stores a copy of the FCB in the FCB cache, replacing an older copy
+ *
+ * If the cache is full, the least recently used FCB which is not referenced
+ * is evicted. If all of them are referenced, the cache grows over capacity
+ * until they are released.
+ *
+ * @param fcb Pointer to the FCB
+ */
+void add_cached_fcb(struct my_fcb*);
+
+/**
+ * @brief Removes a FCB from the FCB cache if it is cached
+ * @param id UUID of the FCB
+ */
+void remove_cached_fcb(uuid_t);
+
+/**
+ * @brief Adds a reference to a FCB, keeping it in the FCB cache until it is released
+ * @param fcb Pointer to the FCB, it is cached if it is not already
+ */
+void hold_cached_fcb(struct my_fcb*);
+
+/**
+ * @brief Removes a reference to a FCB added by hold_cached_fcb
+ *
+ * If the cache is over capacity, unreferenced FCBs are evicted.
+ *
+ * @param id UUID of the FCB
+ */
+void release_cached_fcb(uuid_t);
+
+/**
+ * @brief Deallocates all FCBs in the FCB cache
+ */
+void clean_fcb_cache();
+
+/** @brief Dentry cache shared by all directories */
+extern struct my_cache dentry_cache;
+
+/**
+ * @brief Allocates the dentry cache
+ * @param capacity Maximum number of cached dentries, 0 disables the cache
+ */
+void init_dentry_cache(int);
+
+/**
+ * @brief Looks up a name in a directory in the dentry cache
+ *
+ * Found dentry becomes the most recently used one.
+ *
+ * @param dir_id UUID of the directory
+ * @param name Entry name
+ * @param fcb_id UUID of the entry file, null if the directory has no such entry
+ * @return 1 if the dentry is cached, 0 otherwise
+ */
+char get_cached_dentry(uuid_t, const char*, uuid_t);
+
+/**
+ * @brief Stores the result of looking up a name in a directory in the dentry cache
+ *
+ * If the cache is full, the least recently used dentry is evicted and its
+ * memory reused.
+ *
+ * @param dir_id UUID of the directory
+ * @param name Entry name
+ * @param fcb_id UUID of the entry file, null if the directory has no such entry
+ */
+void add_cached_dentry(uuid_t, const char*, uuid_t);
+
+/**
+ * @brief Deallocates all dentries in the dentry cache
+ */
+void clean_dentry_cache();
+
+/** @brief Inode table of the files known to the kernel */
+extern struct my_inode_table inode_table;
+
+/**
+ * @brief Allocates the inode table
+ *
+ * The root directory gets inode number 1, which the kernel uses for the root
+ * of the mount, and is never forgotten.
+ *
+ * @param root_id UUID of the root directory
+ */
+void init_inode_table(uuid_t);
+
+/**
+ * @brief Counts a lookup of a file by the kernel
+ *
+ * A file which is already known keeps its inode number, so all hard links
+ * to the file share one inode. Otherwise a free inode is taken, the table
+ * grows if there is none.
+ *
+ * @param id UUID of the FCB of the file
+ * @return Inode number of the file
+ */
+unsigned long add_inode_lookup(uuid_t);
+
+/**
+ * @brief Finds the FCB UUID of an inode number
+ * @param ino Inode number
+ * @param id UUID of the FCB of the file
+ * @return 1 if the inode is used, 0 otherwise
+ */
+char get_inode_id(unsigned long, uuid_t);
+
+/**
+ * @brief Returns the generation of an inode number
+ * @param ino Inode number
+ * @return Number of times the inode number was used, 0 if it never was
+ */
+unsigned long get_inode_generation(unsigned long);
+
+/**
+ * @brief Drops lookups forgotten by the kernel, unused inodes are freed
+ * @param ino Inode number
+ * @param nlookup Number of forgotten lookups
+ */
+void forget_inode(unsigned long, unsigned long);
+
+/**
+ * @brief Records that the data or size of the file changed
+ *
+ * The file is then not in sync until the next commit, whichever handle is
+ * used to check it. Must be called inside a database operation. Files
+ * without an inode are not tracked.
+ *
+ * @param id UUID of the FCB of the file
+ */
+void mark_file_data_changed(uuid_t);
+
+/**
+ * @brief Checks whether the data written to the file is committed
+ *
+ * Changes to the FCB which do not affect reading the data, like timestamps
+ * or the mode, are not taken into account. A file which got its inode while
+ * some operations were not committed is in sync after the next commit.
+ *
+ * @param id UUID of the FCB of the file
+ * @return 1 if all data changes are committed, 0 otherwise
+ */
+char is_file_data_synced(uuid_t);
+
+/**
+ * @brief Deallocates the inode table
+ */
+void clean_inode_table();
+
+/**
+ * @brief Locks a FCB for reading or writing
+ *
+ * Readers of the FCB and its data or directory entries take the lock shared,
+ * writers take it exclusive. Directories are locked before the files in them,
+ * which are locked only while their directories are held.
+ *
+ * @param id UUID of the FCB
+ * @param write 1 for an exclusive lock, 0 for a shared one
+ */
+void lock_fcb(uuid_t, char);
+
+/**
+ * @brief Unlocks a FCB locked by lock_fcb
+ * @param id UUID of the FCB
+ */
+void unlock_fcb(uuid_t);
+
+/**
+ * @brief Loads the FCB of the root directory and keeps it in memory
+ *
+ * The pinned copy is returned by read_file and kept up to date by update_file,
+ * so path lookups do not need to read the root directory from the database.
+ */
+void pin_root_fcb();
+
 /**
  * @brief Creates a new file and stores it in the database
  * @param mode File mode
@@ -117,13 +847,28 @@ void create_file(mode_t, struct my_user, struct my_fcb*);
 void create_directory(mode_t, struct my_user, struct my_fcb*);
 
 /**
- * @brief Reads file FCB from the database into memory
+ * @brief Reads file FCB from the pinned root, the FCB cache or the database into memory
  * @param id Database key
  * @param file Pointer to a FCB where the loaded file will be stored
  * @return 0 on success, -1 if not found, -2 on other error
  */
 int read_file(uuid_t*, struct my_fcb*);
 
+/**
+ * @brief Finds a file by its name in a directory
+ *
+ * The dentry cache is checked first, the directory is searched only if the
+ * name is not cached. The user needs execute permission on the directory.
+ *
+ * @param dir Pointer to the FCB of the directory
+ * @param name File name
+ * @param user User and group IDs to check against
+ * @param file Pointer to a FCB where the found file will be stored
+ * @return MYFS_FIND_NO_DIR if dir is not a directory, MYFS_FIND_NO_ACCESS,
+ *         MYFS_FIND_NO_FILE or MYFS_FIND_FOUND
+ */
+int find_dir_child(struct my_fcb*, const char*, struct my_user, struct my_fcb*);
+
 /**
  * @brief Finds a file by its path name in the directory tree
  *
@@ -158,8 +903,23 @@ int find_file(const char*, struct my_user, struct my_fcb*);
  */
 int find_dir_entry(const char*, struct my_user, struct my_fcb*, struct my_fcb*);
 
+/**
+ * @brief Returns the number of bytes of the FCB stored in the database
+ *
+ * Files not larger than MY_INLINE_SIZE keep their data in the FCB and have
+ * no data blocks, only the used part of the inline data is stored. For
+ * larger files only the extents kept in the FCB are stored.
+ *
+ * @param fcb Pointer to the FCB
+ * @return Size of the FCB record
+ */
+size_t get_fcb_record_size(struct my_fcb*);
+
 /**
  * @brief Writes the FCB into the database, replacing the previous version
+ *
+ * The copy in the FCB cache is updated as well.
+ *
  * @param fcb Pointer to the updated FCB, its ID is used as the database key
  */
 void update_file(struct my_fcb*);
@@ -171,9 +931,11 @@ void update_file(struct my_fcb*);
 void remove_file(struct my_fcb*);
 
 /**
- * @brief Changes the size of the file, deleting or creating data blocks as needed
+ * @brief Changes the size of the file, deleting data blocks as needed
  *
- * All new blocks are filled with zeroes
+ * New blocks are holes which read as zeroes, their data blocks are created
+ * when they are first written to. Data of files shrunk to MY_INLINE_SIZE or
+ * less is moved into the FCB, and out of it again if they grow larger.
  *
  * @param fcb Pointer to the updated FCB, its ID is used as the database key
  * @param size New size of the file
@@ -198,6 +960,12 @@ void read_file_data(struct my_fcb*, void*, size_t, off_t);
  */
 void write_file_data(struct my_fcb*, void*, size_t, off_t);
 
+/**
+ * @brief Deletes the index of a directory, used when the directory is removed
+ * @param dir_fcb Pointer to the FCB of the directory
+ */
+void free_dir_index(struct my_fcb*);
+
 /**
  * @brief Adds an entry with the specified name to the directory
  * @param dir_fcb Pointer to the FCB of the directory
@@ -207,6 +975,21 @@ void write_file_data(struct my_fcb*, void*, size_t, off_t);
  */
 int add_dir_entry(struct my_fcb*, struct my_fcb*, const char*);
 
+/**
+ * @brief Finds an entry with the specified name in the directory
+ *
+ * Directories larger than MY_INLINE_SIZE have a B+tree index ordered by name
+ * hash, only the index nodes on the path to the hash and the entries with the
+ * hash are read.
+ * Smaller directories are searched entry by entry.
+ *
+ * @param dir_fcb Pointer to the FCB of the directory
+ * @param name Name of the directory entry
+ * @param entry Pointer to a directory entry where the found entry will be stored
+ * @return Offset of the entry, or -1 if there is no entry with the name
+ */
+int lookup_dir_entry(struct my_fcb*, const char*, struct my_dir_entry*);
+
 /**
  * @brief Removes an entry with the specified name from the directory
  * @param dir_fcb Pointer to the FCB of the directory
@@ -219,7 +1002,9 @@ int remove_dir_entry(struct my_fcb*, const char*);
  * @brief Creates an iterator for directory entries
  *
  * The iterator can be then used with next_dir_entry and has to be passed
- * to clean_dir_iterator when it is no longer needed
+ * to clean_dir_iterator when it is no longer needed. Entries are returned in
+ * the order of their keys, indexed directories are read one index leaf at a
+ * time. The FCB has to stay valid while iterating.
  *
  * @param fcb Pointer to the FCB of the iterated directory
  * @param iterator Pointer to the previously allocated iterator
@@ -228,11 +1013,29 @@ void iterate_dir_entries(struct my_fcb*, struct my_dir_iter*);
 
 /**
  * @brief Returns current directory entry and advances the iterator
+ *
+ * The cookie of the iterator is set to the cookie of the returned entry, and
+ * the offset to the offset of the entry in the directory data. Cookies are
+ * made of the entry key, they are always larger than 2.
+ *
  * @param iterator Pointer to the iterator
  * @return Pointer to an entry, or NULL if the iterator is at the end
  */
 struct my_dir_entry* next_dir_entry(struct my_dir_iter*);
 
+/**
+ * @brief Moves a new iterator after the entry with the specified cookie
+ *
+ * Keys of entries do not change while the entries exist, so iteration can
+ * be resumed even if the entry was removed or its space was reused, each
+ * entry which stayed in the directory is returned exactly once. After an
+ * unknown cookie larger than all keys, no entries are returned.
+ *
+ * @param iterator Pointer to the iterator created by iterate_dir_entries
+ * @param cookie Cookie of the last returned entry, 0 to start at the beginning
+ */
+void seek_dir_iterator(struct my_dir_iter*, off_t);
+
 /**
  * @brief Deallocates memory used by the iterator
  * @param iterator Pointer to the iterator
@@ -240,20 +1043,27 @@ struct my_dir_entry* next_dir_entry(struct my_dir_iter*);
 void clean_dir_iterator(struct my_dir_iter*);
 
 /**
- * @brief Determines directory size
+ * @brief Determines directory size, only the directory header is read
  * @param fcb Pointer to the FCB of the directory
  * @return Number of entries in the directory
  */
 int get_directory_size(struct my_fcb*);
 
 /**
- * @brief Calculates pointer to a directory entry based on the entry index
+ * @brief Calculates pointer to a directory entry based on the entry offset
  * @param dir_data Pointer to the directory data
- * @param offset Directory entry offset/index
+ * @param offset Offset of the directory entry in the directory data
  * @return Pointer to the directory entry in the directory data
  */
 struct my_dir_entry* get_dir_entry(void*, int);
 
+/**
+ * @brief Calculates the size of a stored directory entry
+ * @param name Entry name, names longer than MY_MAX_PATH - 1 are truncated
+ * @return Size of the entry in bytes
+ */
+size_t get_dir_entry_size(const char*);
+
 /**
  * @brief Adds a file to a directory and updates the number of links field
  *
@@ -328,12 +1138,6 @@ char is_file(struct my_fcb*);
 
 char has_permission(struct my_fcb*, struct my_user, mode_t, mode_t, mode_t);
 
-/**
- * @brief Reads the user and group IDs from FUSE context
- * @return User struct with user and group IDs
- */
-struct my_user get_context_user();
-
 /**
  * @brief Determines whether the user can read the file based on its mode
  * @param fcb Pointer to the FCB of the file
@@ -405,6 +1209,84 @@ int remove_open_file(int);
  */
 char is_file_open(struct my_fcb*);
 
+/** @brief Read ahead requests waiting for the read ahead thread */
+extern struct my_readahead_queue readahead_queue;
+
+/**
+ * @brief Starts the thread which loads the blocks queued by read_ahead into the block cache
+ */
+void start_readahead_thread();
+
+/**
+ * @brief Stops the read ahead thread, queued requests are dropped
+ */
+void stop_readahead_thread();
+
+/**
+ * @brief Waits until the read ahead thread has loaded the blocks of all queued requests
+ */
+void wait_readahead_queue();
+
+/**
+ * @brief Reads ahead the blocks following a sequential read through the file handle
+ *
+ * Reads starting where the previous read through the handle ended are
+ * sequential. For each sequential read the number of blocks read ahead is
+ * doubled, up to the maximum, other reads stop the read ahead.
+ *
+ * The blocks are looked up in the extents and queued, the read ahead thread
+ * loads them into the block cache. Nothing is read ahead while the thread
+ * is not running or the queue is full.
+ *
+ * @param fh File handle
+ * @param fcb Pointer to the FCB of the file
+ * @param size Size of the read
+ * @param offset Offset of the read in the file
+ * @param max_blocks Maximum number of blocks to read ahead
+ */
+void read_ahead(int, struct my_fcb*, size_t, off_t, int);
+
+/**
+ * @brief Collects a small write in the write buffer of the file handle
+ *
+ * Consecutive writes to the same block are collected in the buffer and
+ * written to the database together, when the end of the block is reached or
+ * when the buffer is flushed. Writes spanning more blocks are not buffered.
+ * Buffers of other handles of the same file are flushed first, so that they
+ * do not overwrite this write later.
+ *
+ * @param fh File handle
+ * @param buffer Buffer containing the written data
+ * @param size Size of the buffer
+ * @param offset Offset in the file to write data to
+ * @return 1 if the write was buffered, 0 if it has to be written directly
+ */
+char buffer_file_write(int, const void*, size_t, off_t);
+
+/**
+ * @brief Writes the buffered data of the file handle to the database
+ * @param fh File handle
+ */
+void flush_write_buffer(int);
+
+/**
+ * @brief Checks whether some handles of the file have buffered writes
+ * @param id UUID of the FCB of the file
+ * @return 1 if there is some buffered data, 0 otherwise
+ */
+char has_file_buffers(uuid_t);
+
+/**
+ * @brief Writes the buffered data of all handles of the file to the database
+ *
+ * This has to be done before the file data or size is used by anything else
+ * than writes through its handles.
+ *
+ * @param id UUID of the FCB of the file
+ * @return Number of flushed buffers, the FCB has to be read again if not 0
+ */
+int flush_file_buffers(uuid_t);
+
 /**
  * @brief Rounds size up to a multiple of the specified number
  * @param size Number to round up
@@ -448,7 +1330,7 @@ void get_block_indexes(size_t, off_t, int*, int*);
  * on the size and offset. The offset is relative to the start of the file to
  * which the data block belongs.
  *
- * @param id ID of the data block, used as a key in the database
+ * @param id ID of the data block, used as a key in the database, null for a hole
  * @param block Index of the block in the file
  * @param buffer Buffer for the data
  * @param size Size of the buffer
@@ -463,10 +1345,14 @@ void read_block_to_buffer(uuid_t, int, void*, size_t, off_t);
  * into the data block and at which offset in the block. The offset is relative
  * to the start of the file to which the data block belongs.
  *
+ * A new data block does not exist in the database yet, its parts which are
+ * not written are filled with zeroes.
+ *
  * @param id ID of the data block, used as a key in the database
+ * @param is_new Whether the block was just allocated
  * @param block Index of the block in the file
  * @param buffer Buffer for the data
  * @param size Size of the buffer
  * @param offset Offset of the buffer in the written file
  */
-void write_buffer_to_block(uuid_t, int, void*, size_t, off_t);
+void write_buffer_to_block(uuid_t, char, int, void*, size_t, off_t);
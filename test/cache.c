@@ -0,0 +1,276 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+struct my_user user = {1, 1};
+
+/** @brief Entry of the cache used to test the shared hash table and LRU list */
+struct test_entry {
+  struct my_cache_entry entry;
+  int key;
+};
+
+/** Tells whether a test entry has the key */
+static char match_test_entry(struct my_cache_entry* entry, const void* key) {
+  return ((struct test_entry*) entry)->key == *((const int*) key);
+}
+
+/** Adds a test entry with the key, all keys go to the same bucket */
+static void add_test_entry(struct my_cache* cache, int key) {
+  struct test_entry* entry = malloc(sizeof(struct test_entry));
+  entry->key = key;
+  add_cache_entry(cache, &(entry->entry), 0);
+}
+
+/** Looks up a test entry with the key */
+static struct test_entry* lookup_test_entry(struct my_cache* cache, int key) {
+  return (struct test_entry*) lookup_cache_entry(cache, 0, match_test_entry, &key);
+}
+
+static void test_shared_cache() {
+  struct my_cache cache;
+  init_cache(&cache, 4);
+
+  for (int key = 0; key < 3; key++) {
+    add_test_entry(&cache, key);
+  }
+
+  assert(cache.size == 3);
+
+  // lookups count hits and misses and move the found entry to the start
+  assert(lookup_test_entry(&cache, 0)->key == 0);
+  assert(lookup_test_entry(&cache, 3) == NULL);
+  assert(cache.hits == 1);
+  assert(cache.misses == 1);
+
+  assert(((struct test_entry*) cache.lru_first)->key == 0);
+  assert(((struct test_entry*) cache.lru_last)->key == 1);
+
+  // finding an entry does not change the LRU list
+  int key = 1;
+  assert(find_cache_entry(&cache, 0, match_test_entry, &key) == cache.lru_last);
+
+  // removing entries keeps the bucket and the LRU list linked
+  struct my_cache_entry* removed = cache.lru_last;
+  remove_cache_entry(&cache, removed);
+  free(removed);
+
+  assert(cache.size == 2);
+  assert(lookup_test_entry(&cache, 1) == NULL);
+  assert(lookup_test_entry(&cache, 2)->key == 2);
+  assert(((struct test_entry*) cache.lru_last)->key == 0);
+
+  clean_cache(&cache);
+  assert(cache.capacity == 0);
+  assert(cache.lru_first == NULL);
+}
+
+static void test_block_cache() {
+  init_block_cache(2);
+
+  struct my_fcb file_fcb;
+  create_file(0, user, &file_fcb);
+
+  // three full blocks are written without being cached
+  char* data_src = malloc(3 * MY_BLOCK_SIZE);
+  memset(data_src, 1, 3 * MY_BLOCK_SIZE);
+  write_file_data(&file_fcb, data_src, 3 * MY_BLOCK_SIZE, 0);
+  assert(block_cache.size == 0);
+
+  // reading the blocks caches them, the first one is evicted
+  char* data_check = malloc(3 * MY_BLOCK_SIZE);
+  read_file_data(&file_fcb, data_check, 3 * MY_BLOCK_SIZE, 0);
+  assert(memcmp(data_src, data_check, 3 * MY_BLOCK_SIZE) == 0);
+  assert(block_cache.size == 2);
+
+  // partial writes update the cached block
+  memset(data_src, 2, 100);
+  write_file_data(&file_fcb, data_src, 100, 2 * MY_BLOCK_SIZE);
+  read_file_data(&file_fcb, data_check, 100, 2 * MY_BLOCK_SIZE);
+  assert(memcmp(data_src, data_check, 100) == 0);
+  assert(block_cache.misses == 3);
+
+  // removed blocks are removed from the cache
+  truncate_file(&file_fcb, MY_BLOCK_SIZE);
+  assert(block_cache.size == 0);
+
+  clean_block_cache();
+
+  // sequential reads through a file handle read ahead the following blocks
+  // in the read ahead thread
+  init_block_cache(16);
+  start_readahead_thread();
+
+  char* file_data = calloc(8, MY_BLOCK_SIZE);
+  memset(file_data, 3, 8 * MY_BLOCK_SIZE);
+  write_file_data(&file_fcb, file_data, 8 * MY_BLOCK_SIZE, 0);
+
+  int fh = add_open_file(&file_fcb);
+
+  read_file_data(&file_fcb, data_check, MY_BLOCK_SIZE, 0);
+  read_ahead(fh, &file_fcb, MY_BLOCK_SIZE, 0, 8);
+  wait_readahead_queue();
+  assert(block_cache.misses == 1);
+  assert(block_cache.size == 1 + MY_MIN_READAHEAD_BLOCKS);
+
+  read_file_data(&file_fcb, data_check, MY_BLOCK_SIZE, MY_BLOCK_SIZE);
+  read_ahead(fh, &file_fcb, MY_BLOCK_SIZE, MY_BLOCK_SIZE, 8);
+  wait_readahead_queue();
+  assert(block_cache.hits == 1);
+  assert(memcmp(data_check, file_data, MY_BLOCK_SIZE) == 0);
+
+  // the read ahead window has doubled
+  assert(block_cache.size == 2 + 2 * MY_MIN_READAHEAD_BLOCKS);
+
+  // without the thread nothing is read ahead
+  stop_readahead_thread();
+
+  read_file_data(&file_fcb, data_check, MY_BLOCK_SIZE, 2 * MY_BLOCK_SIZE);
+  read_ahead(fh, &file_fcb, MY_BLOCK_SIZE, 2 * MY_BLOCK_SIZE, 8);
+  assert(block_cache.size == 2 + 2 * MY_MIN_READAHEAD_BLOCKS);
+
+  remove_open_file(fh);
+  clean_block_cache();
+
+  free(data_src);
+  free(data_check);
+  free(file_data);
+}
+
+static void test_fcb_cache() {
+  init_fcb_cache(2);
+
+  // created files are cached
+  struct my_fcb file1, file2, file3;
+  create_file(0, user, &file1);
+  assert(get_cached_fcb(file1.id) != NULL);
+
+  // reading a cached file does not miss
+  struct my_fcb check_fcb;
+  read_file(&(file1.id), &check_fcb);
+  assert(uuid_compare(check_fcb.id, file1.id) == 0);
+  assert(fcb_cache.misses == 0);
+
+  // the cache is written through, changes are visible in the cached copy
+  file1.mode = S_IRUSR;
+  file1.nlink = 1;
+  update_file(&file1);
+  assert(get_cached_fcb(file1.id)->mode == S_IRUSR);
+
+  // opening the file keeps it in the cache even if it is full
+  int fh = add_open_file(&file1);
+  create_file(0, user, &file2);
+  create_file(0, user, &file3);
+
+  assert(get_cached_fcb(file1.id) != NULL);
+  assert(get_cached_fcb(file2.id) == NULL);
+  assert(get_cached_fcb(file3.id) != NULL);
+
+  // evicted files are read from the database and cached again
+  read_file(&(file2.id), &check_fcb);
+  assert(uuid_compare(check_fcb.id, file2.id) == 0);
+  assert(get_cached_fcb(file2.id) != NULL);
+
+  // when all cached files are open, the cache grows over capacity
+  file2.nlink = file3.nlink = 1;
+  update_file(&file2);
+  update_file(&file3);
+
+  int fh2 = add_open_file(&file2);
+  int fh3 = add_open_file(&file3);
+  create_file(0, user, &check_fcb);
+  assert(fcb_cache.size == 4);
+
+  // and shrinks back once they are closed, keeping the open file
+  remove_open_file(fh3);
+  remove_open_file(fh2);
+  assert(fcb_cache.size == 2);
+  assert(get_cached_fcb(file1.id) != NULL);
+
+  // after closing the file it can be evicted
+  remove_open_file(fh);
+  read_file(&(file3.id), &check_fcb);
+  read_file(&(file2.id), &check_fcb);
+  assert(get_cached_fcb(file1.id) == NULL);
+  assert(read_file(&(file1.id), &check_fcb) == 0);
+
+  // removed files are not cached
+  remove_file(&file3);
+  assert(get_cached_fcb(file3.id) == NULL);
+  assert(read_file(&(file3.id), &check_fcb) == -1);
+
+  clean_fcb_cache();
+}
+
+static void test_dentry_cache() {
+  init_dentry_cache(4);
+
+  struct my_fcb root_dir;
+  create_directory(S_IXUSR, user, &root_dir);
+
+  uuid_copy(root_object.id, root_dir.id);
+
+  struct my_fcb dir1;
+  create_directory(S_IXUSR, user, &dir1);
+
+  struct my_fcb file1;
+  create_file(0, user, &file1);
+
+  add_dir_entry(&root_dir, &dir1, "dir1");
+  add_dir_entry(&dir1, &file1, "file1");
+
+  // added entries are cached, so the lookup does not miss
+  struct my_fcb found_file;
+  assert(find_file("/dir1/file1", user, &found_file) == MYFS_FIND_FOUND);
+  assert(uuid_compare(found_file.id, file1.id) == 0);
+  assert(dentry_cache.misses == 0);
+  assert(dentry_cache.hits == 2);
+
+  // missing names are cached as negative entries
+  assert(find_file("/dir1/foo", user, &found_file) == MYFS_FIND_NO_FILE);
+  assert(dentry_cache.misses == 1);
+
+  uuid_t fcb_id;
+  assert(get_cached_dentry(dir1.id, "foo", fcb_id) == 1);
+  assert(uuid_is_null(fcb_id));
+
+  // so looking the name up again does not search the directory
+  assert(find_file("/dir1/foo", user, &found_file) == MYFS_FIND_NO_FILE);
+  assert(dentry_cache.misses == 1);
+
+  // adding the missing entry replaces the negative entry
+  struct my_fcb file2;
+  create_file(0, user, &file2);
+  add_dir_entry(&dir1, &file2, "foo");
+
+  assert(find_file("/dir1/foo", user, &found_file) == MYFS_FIND_FOUND);
+  assert(uuid_compare(found_file.id, file2.id) == 0);
+
+  // removing an entry makes it negative again
+  remove_dir_entry(&dir1, "file1");
+  assert(find_file("/dir1/file1", user, &found_file) == MYFS_FIND_NO_FILE);
+
+  // the least recently used entries are evicted, lookups still work
+  clean_dentry_cache();
+  init_dentry_cache(1);
+
+  assert(find_file("/dir1/foo", user, &found_file) == MYFS_FIND_FOUND);
+  assert(uuid_compare(found_file.id, file2.id) == 0);
+  assert(dentry_cache.size == 1);
+  assert(get_cached_dentry(root_dir.id, "dir1", fcb_id) == 0);
+
+  clean_dentry_cache();
+}
+
+int main() {
+  int rc = unqlite_open(&pDb, "cache.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  test_shared_cache();
+  test_block_cache();
+  test_fcb_cache();
+  test_dentry_cache();
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
@@ -20,8 +20,21 @@ int main() {
 
   assert(memcmp(data_src, data_check, 1000) == 0);
 
+  void* range_check = malloc(100);
+  read_db_object_range(key, range_check, 100, 500);
+
+  assert(memcmp(data_src + 500, range_check, 100) == 0);
+
+  // fetching returns the stored size even if the buffer is smaller
+  void* fetch_check = malloc(1000);
+  assert(fetch_db_object(key, fetch_check, 100) == 1000);
+  assert(memcmp(data_src, fetch_check, 100) == 0);
+  assert(fetch_db_object(key, fetch_check, 1000) == 1000);
+  assert(memcmp(data_src, fetch_check, 1000) == 0);
+
   delete_db_object(key);
   assert(!has_db_object(key));
+  assert(fetch_db_object(key, fetch_check, 1000) == -1);
 
   puts("Test passed");
 
@@ -0,0 +1,181 @@
+#include <assert.h>
+#include <limits.h>
+#include "../myfs_lib.h"
+
+/** Enough entries for an index with three levels */
+#define NUM_FILES 100000
+
+/** Cookies of the entries from the first iteration */
+off_t cookies[NUM_FILES];
+
+/** Number of times each entry was returned */
+int returned[NUM_FILES];
+
+/** Whether each original entry is in the directory */
+char present[NUM_FILES];
+
+/**
+ * Iterates the directory after the cookie, checking that cookies go up and
+ * counting the returned original entries
+ */
+static void iterate_after(struct my_fcb* dir, off_t cookie) {
+  struct my_dir_iter iter;
+  struct my_dir_entry* next;
+  off_t last = cookie;
+
+  memset(returned, 0, sizeof(returned));
+
+  iterate_dir_entries(dir, &iter);
+  seek_dir_iterator(&iter, cookie);
+
+  while ((next = next_dir_entry(&iter)) != NULL) {
+    assert(iter.cookie > last);
+    last = iter.cookie;
+
+    int i;
+    if (sscanf(next->name, "file%d", &i) == 1) {
+      assert(cookies[i] == iter.cookie);
+      returned[i]++;
+    }
+  }
+
+  clean_dir_iterator(&iter);
+}
+
+int main() {
+  int rc = unqlite_open(&pDb, "dir_btree.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb dir;
+  create_directory(0, user, &dir);
+
+  struct my_fcb file;
+  create_file(0, user, &file);
+
+  struct my_dir_entry entry;
+  char name[MY_MAX_PATH];
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    sprintf(name, "file%d", i);
+    assert(add_dir_entry(&dir, &file, name) == 0);
+    present[i] = 1;
+  }
+
+  struct my_dir_header dir_header;
+  read_file_data(&dir, &dir_header, sizeof(dir_header), 0);
+  assert(!uuid_is_null(dir_header.index_id));
+
+  // there are more leaves than one inner node can point to
+  assert(dir_header.index_nodes > MY_DIR_NODE_RECORDS + 2);
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    sprintf(name, "file%d", i);
+    assert(lookup_dir_entry(&dir, name, &entry) > -1);
+    assert(strcmp(entry.name, name) == 0);
+  }
+
+  // entries are iterated in key order, each of them once
+  struct my_dir_iter iter;
+  struct my_dir_entry* next;
+  int count = 0;
+  off_t cookie = 0;
+  int middle = -1;
+
+  iterate_dir_entries(&dir, &iter);
+
+  while ((next = next_dir_entry(&iter)) != NULL) {
+    int i;
+    assert(sscanf(next->name, "file%d", &i) == 1);
+    assert(cookies[i] == 0);
+    assert(iter.cookie > cookie);
+
+    cookies[i] = cookie = iter.cookie;
+
+    // remember an entry in the middle of the iteration
+    if (count == NUM_FILES / 2) middle = i;
+    count++;
+  }
+
+  clean_dir_iterator(&iter);
+  assert(count == NUM_FILES);
+
+  cookie = cookies[middle];
+
+  // remove the entry and every third one, and reuse their space for new
+  // names with the same length
+  sprintf(name, "file%d", middle);
+  assert(remove_dir_entry(&dir, name) == 0);
+  present[middle] = 0;
+
+  for (int i = 0; i < NUM_FILES; i += 3) {
+    if (!present[i]) continue;
+
+    sprintf(name, "file%d", i);
+    assert(remove_dir_entry(&dir, name) == 0);
+    present[i] = 0;
+  }
+
+  for (int i = 0; i < NUM_FILES; i += 3) {
+    sprintf(name, "gile%d", i);
+    assert(add_dir_entry(&dir, &file, name) == 0);
+  }
+
+  assert(lookup_dir_entry(&dir, "file0", &entry) == -1);
+  assert(lookup_dir_entry(&dir, "gile0", &entry) > -1);
+
+  // iteration resumes after the removed entry, every entry which stayed is
+  // returned exactly once if it was after the cookie
+  iterate_after(&dir, cookie);
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    assert(returned[i] == (present[i] && cookies[i] > cookie));
+  }
+
+  // after the last key there are no entries
+  iterate_after(&dir, ((off_t) UINT_MAX << 31) | INT_MAX);
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    assert(returned[i] == 0);
+  }
+
+  // removing all entries merges the nodes, adding them back reuses them
+  for (int i = 0; i < NUM_FILES; i++) {
+    sprintf(name, "file%d", i);
+    assert((remove_dir_entry(&dir, name) == 0) == present[i]);
+
+    sprintf(name, "gile%d", i);
+    assert((remove_dir_entry(&dir, name) == 0) == (i % 3 == 0));
+  }
+
+  assert(get_directory_size(&dir) == 0);
+
+  read_file_data(&dir, &dir_header, sizeof(dir_header), 0);
+  assert(dir_header.index_free >= 0);
+
+  int index_nodes = dir_header.index_nodes;
+
+  for (int i = 0; i < NUM_FILES / 2; i++) {
+    sprintf(name, "file%d", i);
+    assert(add_dir_entry(&dir, &file, name) == 0);
+  }
+
+  read_file_data(&dir, &dir_header, sizeof(dir_header), 0);
+  assert(dir_header.index_nodes == index_nodes);
+
+  for (int i = 0; i < NUM_FILES / 2; i++) {
+    sprintf(name, "file%d", i);
+    assert(lookup_dir_entry(&dir, name, &entry) > -1);
+  }
+
+  // removing the directory removes its index nodes
+  uuid_t node_id;
+  memcpy(node_id, dir_header.index_id, sizeof(uuid_t));
+  remove_file(&dir);
+  assert(!has_db_object(node_id));
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
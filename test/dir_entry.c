@@ -41,31 +41,66 @@ int main() {
   struct my_dir_iter iter;
   iterate_dir_entries(&dir, &iter);
 
+  // entries are returned in key order, each of them once
   struct my_dir_entry* entry;
+  char names[3][MY_MAX_PATH];
+  off_t cookies[3];
+
+  for (int i = 0; i < 3; i++) {
+    entry = next_dir_entry(&iter);
+    assert(entry != NULL);
+    strcpy(names[i], entry->name);
+    cookies[i] = iter.cookie;
+    assert(cookies[i] > 2);
+    assert(i == 0 || cookies[i] > cookies[i - 1]);
+
+    struct my_fcb* file = strcmp(entry->name, "file3") == 0 ? &file3 :
+      strcmp(entry->name, "file4") == 0 ? &file2 : &file4;
+    assert(uuid_compare(entry->fcb_id, file->id) == 0);
+  }
+
+  assert(next_dir_entry(&iter) == NULL);
+  assert(strcmp(names[0], names[1]) != 0);
+  assert(strcmp(names[0], names[2]) != 0);
+  assert(strcmp(names[1], names[2]) != 0);
 
-  entry = next_dir_entry(&iter);
-  assert(entry != NULL);
-  assert(strcmp(entry->name, "file5") == 0);
-  assert(uuid_compare(entry->fcb_id, file4.id) == 0);
+  clean_dir_iterator(&iter);
 
-  entry = next_dir_entry(&iter);
-  assert(entry != NULL);
-  assert(strcmp(entry->name, "file4") == 0);
-  assert(uuid_compare(entry->fcb_id, file2.id) == 0);
+  // iteration can be resumed after an entry
+  iterate_dir_entries(&dir, &iter);
+  seek_dir_iterator(&iter, cookies[1]);
 
   entry = next_dir_entry(&iter);
   assert(entry != NULL);
-  assert(strcmp(entry->name, "file3") == 0);
-  assert(uuid_compare(entry->fcb_id, file3.id) == 0);
+  assert(strcmp(entry->name, names[2]) == 0);
+  assert(next_dir_entry(&iter) == NULL);
 
-  entry = next_dir_entry(&iter);
-  assert(entry == NULL);
+  clean_dir_iterator(&iter);
 
+  // there are no entries after the last one
+  iterate_dir_entries(&dir, &iter);
+  seek_dir_iterator(&iter, cookies[2]);
+  assert(next_dir_entry(&iter) == NULL);
   clean_dir_iterator(&iter);
 
   remove_dir_entry(&dir, "file5");
   assert(get_directory_size(&dir) == 2);
 
+  // entries only take as much space as their names need
+  assert(get_dir_entry_size("file1") < sizeof(struct my_dir_entry));
+  assert(dir.size == (off_t)(sizeof(struct my_dir_header) + 3 * get_dir_entry_size("file1")));
+
+  // a longer name does not fit in the unused entry, so a new one is added
+  add_dir_entry(&dir, &file1, "a_much_longer_file_name");
+  assert(dir.size == (off_t)(sizeof(struct my_dir_header) + 3 * get_dir_entry_size("file1")
+    + get_dir_entry_size("a_much_longer_file_name")));
+
+  // a shorter one reuses it
+  add_dir_entry(&dir, &file1, "f");
+  assert(dir.size == (off_t)(sizeof(struct my_dir_header) + 3 * get_dir_entry_size("file1")
+    + get_dir_entry_size("a_much_longer_file_name")));
+  assert(get_directory_size(&dir) == 4);
+
   puts("Test passed");
 
   unqlite_close(pDb);
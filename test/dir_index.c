@@ -0,0 +1,70 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+#define NUM_FILES 1000
+
+int main() {
+  int rc = unqlite_open(&pDb, "dir_index.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb dir;
+  create_directory(0, user, &dir);
+
+  struct my_fcb file;
+  create_file(0, user, &file);
+
+  struct my_dir_header dir_header;
+  struct my_dir_entry entry;
+  char name[MY_MAX_PATH];
+
+  // small directories are not indexed
+  add_dir_entry(&dir, &file, "file0");
+  read_file_data(&dir, &dir_header, sizeof(dir_header), 0);
+  assert(uuid_is_null(dir_header.index_id));
+  assert(lookup_dir_entry(&dir, "file0", &entry) == sizeof(struct my_dir_header));
+
+  for (int i = 1; i < NUM_FILES; i++) {
+    sprintf(name, "file%d", i);
+    add_dir_entry(&dir, &file, name);
+  }
+
+  // once the directory does not fit in the FCB, it gets an index
+  read_file_data(&dir, &dir_header, sizeof(dir_header), 0);
+  assert(!uuid_is_null(dir_header.index_id));
+
+  // entries are written one by one, some of them across data blocks
+  assert(dir.size > MY_BLOCK_SIZE);
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    sprintf(name, "file%d", i);
+    assert(lookup_dir_entry(&dir, name, &entry) > -1);
+    assert(strcmp(entry.name, name) == 0);
+    assert(uuid_compare(entry.fcb_id, file.id) == 0);
+  }
+
+  assert(lookup_dir_entry(&dir, "foo", &entry) == -1);
+
+  // removed entries are removed from the index too
+  for (int i = 0; i < NUM_FILES; i += 2) {
+    sprintf(name, "file%d", i);
+    assert(remove_dir_entry(&dir, name) == 0);
+  }
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    sprintf(name, "file%d", i);
+    assert((lookup_dir_entry(&dir, name, &entry) > -1) == (i % 2 == 1));
+  }
+
+  assert(remove_dir_entry(&dir, "file0") == -1);
+
+  // reused entries are found by their new names
+  add_dir_entry(&dir, &file, "bar");
+  assert(lookup_dir_entry(&dir, "bar", &entry) > -1);
+  assert(get_directory_size(&dir) == NUM_FILES / 2 + 1);
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
@@ -0,0 +1,64 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+#define NUM_FILES 300
+
+int main() {
+  int rc = unqlite_open(&pDb, "dir_size.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb dir;
+  create_directory(0, user, &dir);
+
+  struct my_fcb file;
+  create_file(0, user, &file);
+
+  struct my_dir_header dir_header;
+  char name[MY_MAX_PATH];
+
+  // a new directory is empty and has no free index nodes
+  read_file_data(&dir, &dir_header, sizeof(dir_header), 0);
+  assert(dir_header.num_entries == 0);
+  assert(dir_header.index_free == -1);
+  assert(get_directory_size(&dir) == 0);
+
+  // every added entry is counted, also after the directory gets an index
+  for (int i = 0; i < NUM_FILES; i++) {
+    sprintf(name, "file%d", i);
+    assert(add_dir_entry(&dir, &file, name) == 0);
+    assert(get_directory_size(&dir) == i + 1);
+  }
+
+  read_file_data(&dir, &dir_header, sizeof(dir_header), 0);
+  assert(!uuid_is_null(dir_header.index_id));
+
+  // removing a missing name does not change the count
+  assert(remove_dir_entry(&dir, "missing") == -1);
+  assert(get_directory_size(&dir) == NUM_FILES);
+
+  // the count is stored with the directory
+  struct my_fcb check_dir;
+  assert(read_file(&(dir.id), &check_dir) == 0);
+  assert(get_directory_size(&check_dir) == NUM_FILES);
+
+  // rmdir only removes directories whose count dropped back to zero
+  for (int i = 0; i < NUM_FILES; i++) {
+    sprintf(name, "file%d", i);
+    assert(remove_dir_entry(&dir, name) == 0);
+    assert(get_directory_size(&dir) == NUM_FILES - i - 1);
+  }
+
+  assert(get_directory_size(&dir) == 0);
+
+  // the unused entries do not count
+  add_dir_entry(&dir, &file, "file");
+  assert(get_directory_size(&dir) == 1);
+  remove_dir_entry(&dir, "file");
+  assert(get_directory_size(&dir) == 0);
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
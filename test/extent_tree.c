@@ -0,0 +1,105 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+/** Enough extents for a tree with three levels */
+#define NUM_EXTENTS 20000
+
+/** Returns the stored size of a database object */
+static unqlite_int64 get_object_size(uuid_t id) {
+  unqlite_int64 size = 0;
+  assert(unqlite_kv_fetch(pDb, id, sizeof(uuid_t), NULL, &size) == UNQLITE_OK);
+  return size;
+}
+
+int main() {
+  int rc = unqlite_open(&pDb, "extent_tree.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb file_fcb;
+  create_file(0, user, &file_fcb);
+
+  // every other block is written, so each block gets its own extent
+  char data = 1;
+
+  for (int i = 0; i < NUM_EXTENTS; i++) {
+    write_file_data(&file_fcb, &data, 1, (off_t)(2 * i) * MY_BLOCK_SIZE);
+  }
+
+  assert(file_fcb.num_extents == NUM_EXTENTS);
+  assert(!uuid_is_null(file_fcb.extent_list));
+
+  // the root and the nodes below it have a fixed maximum size
+  struct my_extent_node node;
+  read_db_object(file_fcb.extent_list, &node, sizeof(node));
+  assert(get_object_size(file_fcb.extent_list) <= MY_EXTENT_NODE_SIZE);
+  assert(!node.leaf);
+
+  uuid_t child_id;
+  uuid_copy(child_id, node.extents[0].base);
+  read_db_object(child_id, &node, sizeof(node));
+  assert(get_object_size(child_id) <= MY_EXTENT_NODE_SIZE);
+  assert(!node.leaf);
+
+  // a lookup loads only the nodes on the path to one leaf
+  struct my_extent_map map;
+  open_extents(&file_fcb, &map);
+
+  uuid_t first_id, block_id;
+  get_block_id(&map, 0, first_id);
+  assert(!uuid_is_null(first_id));
+  assert(map.depth == 3);
+
+  for (int i = NUM_EXTENTS - 1; i >= 0; i -= 7) {
+    get_block_id(&map, 2 * i, block_id);
+    assert(!uuid_is_null(block_id));
+
+    get_block_id(&map, 2 * i + 1, block_id);
+    assert(uuid_is_null(block_id));
+  }
+
+  close_extents(&map);
+
+  // filling a hole extends the extent before it
+  write_file_data(&file_fcb, &data, 1, (off_t)(2 * 1000 + 1) * MY_BLOCK_SIZE);
+  assert(file_fcb.num_extents == NUM_EXTENTS);
+
+  struct my_fcb check_fcb;
+  read_file(&(file_fcb.id), &check_fcb);
+
+  char check = 0;
+  read_file_data(&check_fcb, &check, 1, (off_t)(2 * 1000 + 1) * MY_BLOCK_SIZE);
+  assert(check == data);
+
+  // shrinking the file keeps the tree while the extents do not fit in the FCB
+  truncate_file(&file_fcb, (off_t)NUM_EXTENTS * MY_BLOCK_SIZE);
+  assert(file_fcb.num_extents == NUM_EXTENTS / 2);
+  assert(!uuid_is_null(file_fcb.extent_list));
+
+  open_extents(&file_fcb, &map);
+  get_block_id(&map, NUM_EXTENTS - 2, block_id);
+  assert(!uuid_is_null(block_id));
+  get_block_id(&map, NUM_EXTENTS, block_id);
+  assert(uuid_is_null(block_id));
+  close_extents(&map);
+
+  // and moves them back into the FCB, deleting the tree
+  uuid_t root_id;
+  uuid_copy(root_id, file_fcb.extent_list);
+
+  truncate_file(&file_fcb, 9 * MY_BLOCK_SIZE + 100);
+  assert(file_fcb.num_extents == 5);
+  assert(uuid_is_null(file_fcb.extent_list));
+  assert(!has_db_object(root_id));
+  assert(!has_db_object(child_id));
+
+  // removing the file deletes all its data blocks
+  remove_file(&file_fcb);
+  assert(!has_db_object(first_id));
+  assert(!has_db_object(file_fcb.id));
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
@@ -0,0 +1,87 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+int main() {
+  int rc = unqlite_open(&pDb, "extents.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb file_fcb;
+  create_file(0, user, &file_fcb);
+
+  void* block_data = malloc(MY_BLOCK_SIZE);
+  memset(block_data, 1, MY_BLOCK_SIZE);
+
+  // sequentially written blocks are mapped by a single extent
+  for (int block = 0; block < 4; block++) {
+    write_file_data(&file_fcb, block_data, MY_BLOCK_SIZE, (off_t)block * MY_BLOCK_SIZE);
+  }
+
+  assert(file_fcb.num_extents == 1);
+  assert(file_fcb.extents[0].start == 0);
+  assert(file_fcb.extents[0].length == 4);
+
+  // and their keys only differ in the block offset
+  struct my_extent_map map;
+  open_extents(&file_fcb, &map);
+
+  uuid_t first_id, second_id;
+  get_block_id(&map, 0, first_id);
+  get_block_id(&map, 1, second_id);
+  assert(memcmp(first_id, second_id, 15) == 0);
+  assert(second_id[15] == first_id[15] + 1);
+
+  // blocks after the end are holes
+  get_block_id(&map, 4, second_id);
+  assert(uuid_is_null(second_id));
+  close_extents(&map);
+
+  // a block after a hole starts a new extent
+  write_file_data(&file_fcb, block_data, MY_BLOCK_SIZE, 10 * MY_BLOCK_SIZE);
+  assert(file_fcb.num_extents == 2);
+  assert(file_fcb.extents[1].start == 10);
+
+  // filling the hole extends the first extent and keeps them sorted
+  write_file_data(&file_fcb, block_data, MY_BLOCK_SIZE, 4 * MY_BLOCK_SIZE);
+  write_file_data(&file_fcb, block_data, MY_BLOCK_SIZE, 8 * MY_BLOCK_SIZE);
+  assert(file_fcb.num_extents == 3);
+  assert(file_fcb.extents[0].length == 5);
+  assert(file_fcb.extents[1].start == 8);
+  assert(file_fcb.extents[2].start == 10);
+
+  // too many extents to fit in the FCB are moved to the extent list
+  for (int i = 0; i < MY_FCB_EXTENTS; i++) {
+    write_file_data(&file_fcb, block_data, MY_BLOCK_SIZE, (off_t)(12 + 2 * i) * MY_BLOCK_SIZE);
+  }
+
+  assert(file_fcb.num_extents == MY_FCB_EXTENTS + 3);
+  assert(!uuid_is_null(file_fcb.extent_list));
+  assert(get_fcb_record_size(&file_fcb) == offsetof(struct my_fcb, extents));
+
+  struct my_fcb check_fcb;
+  read_file(&(file_fcb.id), &check_fcb);
+
+  void* check_data = malloc(MY_BLOCK_SIZE);
+  read_file_data(&check_fcb, check_data, MY_BLOCK_SIZE, (off_t)(12 + 2 * (MY_FCB_EXTENTS - 1)) * MY_BLOCK_SIZE);
+  assert(memcmp(check_data, block_data, MY_BLOCK_SIZE) == 0);
+
+  // shrinking the file moves the extents back into the FCB
+  uuid_t list_id;
+  uuid_copy(list_id, file_fcb.extent_list);
+
+  truncate_file(&file_fcb, 9 * MY_BLOCK_SIZE + 100);
+  assert(file_fcb.num_extents == 2);
+  assert(file_fcb.extents[1].length == 1);
+  assert(uuid_is_null(file_fcb.extent_list));
+  assert(!has_db_object(list_id));
+
+  // removing the file deletes all its data blocks
+  remove_file(&file_fcb);
+  assert(!has_db_object(first_id));
+  assert(!has_db_object(file_fcb.id));
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
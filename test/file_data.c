@@ -35,6 +35,38 @@ void test_read_write(size_t size, off_t offset) {
   free(data_check);
 }
 
+void test_full_block_write() {
+  init_block_cache(16);
+
+  struct my_fcb file_fcb;
+  create_file(0, user, &file_fcb);
+
+  char* data_src = malloc(4 * MY_BLOCK_SIZE);
+  memset(data_src, 1, 4 * MY_BLOCK_SIZE);
+  write_file_data(&file_fcb, data_src, 4 * MY_BLOCK_SIZE, 0);
+
+  // overwriting whole stored blocks does not fetch them first
+  clean_block_cache();
+  init_block_cache(16);
+  memset(data_src + MY_BLOCK_SIZE, 2, 2 * MY_BLOCK_SIZE);
+  write_file_data(&file_fcb, data_src + MY_BLOCK_SIZE, 2 * MY_BLOCK_SIZE, MY_BLOCK_SIZE);
+  assert(block_cache.misses == 0);
+
+  char* data_check = malloc(4 * MY_BLOCK_SIZE);
+  read_file_data(&file_fcb, data_check, 4 * MY_BLOCK_SIZE, 0);
+  assert(memcmp(data_src, data_check, 4 * MY_BLOCK_SIZE) == 0);
+
+  // a partial write of a block that is not cached still fetches it
+  clean_block_cache();
+  init_block_cache(16);
+  write_file_data(&file_fcb, data_src, MY_BLOCK_SIZE / 2, 0);
+  assert(block_cache.misses == 1);
+
+  free(data_src);
+  free(data_check);
+  clean_block_cache();
+}
+
 int main() {
   int rc = unqlite_open(&pDb, "file_data.db", UNQLITE_OPEN_CREATE);
   if (rc != UNQLITE_OK) error_handler(rc);
@@ -52,8 +84,11 @@ int main() {
   test_read_write(5 * MY_BLOCK_SIZE, 0);
   test_read_write(5 * MY_BLOCK_SIZE, MY_BLOCK_SIZE / 2);
 
-  // all blocks
-  test_read_write(MY_MAX_BLOCKS * MY_BLOCK_SIZE, 0);
+  // blocks at the end of the largest possible file
+  test_read_write(3 * MY_BLOCK_SIZE, (off_t)(MY_MAX_BLOCKS - 4) * MY_BLOCK_SIZE + MY_BLOCK_SIZE / 2);
+
+  // aligned writes of whole blocks
+  test_full_block_write();
 
   puts("Test passed");
 
@@ -0,0 +1,77 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+// writes an object with a new key in one operation
+void write_object(uuid_t key) {
+  char data[100] = {0};
+  uuid_generate(key);
+
+  begin_db_operation();
+  write_db_object(key, data, sizeof(data));
+  end_db_operation();
+}
+
+int main() {
+  int rc = unqlite_open(&pDb, "group_commit.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  unqlite_config(pDb, UNQLITE_CONFIG_DISABLE_AUTO_COMMIT);
+  init_group_commit(3, 0);
+
+  uuid_t key1, key2, key3;
+
+  // operations are committed in groups of three
+  write_object(key1);
+  write_object(key2);
+  assert(group_commit.commits == 0);
+  assert(group_commit.pending == 2);
+
+  write_object(key3);
+  assert(group_commit.commits == 1);
+  assert(group_commit.pending == 0);
+
+  // the commit waits until the operation in progress finishes
+  begin_db_operation();
+  write_object(key1);
+  write_object(key2);
+  write_object(key3);
+  assert(group_commit.commits == 1);
+  assert(group_commit.wanted);
+
+  end_db_operation();
+  assert(group_commit.commits == 2);
+  assert(!group_commit.wanted);
+
+  // committed objects survive closing the database, uncommitted ones do not
+  write_object(key1);
+  commit_db();
+  assert(group_commit.commits == 3);
+
+  write_object(key2);
+  unqlite_close(pDb);
+
+  rc = unqlite_open(&pDb, "group_commit.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  unqlite_config(pDb, UNQLITE_CONFIG_DISABLE_AUTO_COMMIT);
+
+  assert(has_db_object(key1));
+  assert(!has_db_object(key2));
+
+  // finished operations are committed by the thread after the interval
+  init_group_commit(100, 1);
+  start_commit_thread();
+
+  write_object(key1);
+  assert(group_commit.commits == 0);
+
+  sleep(2);
+  assert(group_commit.commits == 1);
+  assert(group_commit.pending == 0);
+
+  stop_commit_thread();
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
@@ -0,0 +1,79 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+int main() {
+  int rc = unqlite_open(&pDb, "inline_data.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb file_fcb;
+  create_file(0, user, &file_fcb);
+
+  char data[MY_INLINE_SIZE];
+  for (int i = 0; i < MY_INLINE_SIZE; i++) {
+    data[i] = i % 251;
+  }
+
+  // small files are stored in the FCB without any data blocks
+  write_file_data(&file_fcb, data, 1000, 0);
+  assert(file_fcb.num_extents == 0);
+  assert(get_fcb_record_size(&file_fcb) == offsetof(struct my_fcb, inline_data) + 1000);
+
+  struct my_fcb check_fcb;
+  read_file(&(file_fcb.id), &check_fcb);
+  assert(check_fcb.size == 1000);
+
+  char check_data[MY_INLINE_SIZE];
+  read_file_data(&check_fcb, check_data, 1000, 0);
+  assert(memcmp(check_data, data, 1000) == 0);
+
+  // writing after the end leaves a gap of zeroes
+  write_file_data(&file_fcb, data, 500, 1500);
+  read_file(&(file_fcb.id), &check_fcb);
+  read_file_data(&check_fcb, check_data, 2000, 0);
+  assert(memcmp(check_data, data, 1000) == 0);
+  assert(check_data[1000] == 0 && check_data[1499] == 0);
+  assert(memcmp(check_data + 1500, data, 500) == 0);
+
+  // growing the file past the inline size moves the data into a block
+  write_file_data(&file_fcb, data, MY_INLINE_SIZE, MY_INLINE_SIZE);
+  assert(file_fcb.num_extents == 1);
+  assert(get_fcb_record_size(&file_fcb) == offsetof(struct my_fcb, extents) + sizeof(struct my_extent));
+
+  read_file(&(file_fcb.id), &check_fcb);
+  read_file_data(&check_fcb, check_data, 1000, 0);
+  assert(memcmp(check_data, data, 1000) == 0);
+  read_file_data(&check_fcb, check_data, MY_INLINE_SIZE, MY_INLINE_SIZE);
+  assert(memcmp(check_data, data, MY_INLINE_SIZE) == 0);
+
+  // shrinking it moves the data back into the FCB and deletes the block
+  struct my_extent_map map;
+  open_extents(&file_fcb, &map);
+
+  uuid_t block_id;
+  get_block_id(&map, 0, block_id);
+  close_extents(&map);
+
+  truncate_file(&file_fcb, 800);
+  assert(file_fcb.num_extents == 0);
+  assert(!has_db_object(block_id));
+
+  read_file(&(file_fcb.id), &check_fcb);
+  read_file_data(&check_fcb, check_data, 800, 0);
+  assert(memcmp(check_data, data, 800) == 0);
+
+  // growing with truncate moves the data out of the FCB again
+  truncate_file(&file_fcb, 3 * MY_INLINE_SIZE);
+  read_file(&(file_fcb.id), &check_fcb);
+  read_file_data(&check_fcb, check_data, MY_INLINE_SIZE, 0);
+  assert(memcmp(check_data, data, 800) == 0);
+  assert(check_data[800] == 0 && check_data[MY_INLINE_SIZE - 1] == 0);
+
+  remove_file(&file_fcb);
+  assert(!has_db_object(file_fcb.id));
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
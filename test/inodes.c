@@ -0,0 +1,75 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+#define NUM_FILES 3000
+
+int main() {
+  int rc = unqlite_open(&pDb, "inodes.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  uuid_t root_id;
+  uuid_generate(root_id);
+  init_inode_table(root_id);
+
+  uuid_t id;
+
+  // the root is inode 1
+  assert(get_inode_id(1, id) == 1);
+  assert(uuid_compare(id, root_id) == 0);
+  assert(get_inode_id(2, id) == 0);
+
+  // looking the same file up again gives the same inode
+  uuid_t file_id;
+  uuid_generate(file_id);
+
+  unsigned long ino = add_inode_lookup(file_id);
+  assert(ino == 2);
+  assert(add_inode_lookup(file_id) == ino);
+
+  assert(get_inode_id(ino, id) == 1);
+  assert(uuid_compare(id, file_id) == 0);
+
+  unsigned long generation = inode_table.inodes[ino - 1].generation;
+
+  // the inode is used until all lookups are forgotten
+  forget_inode(ino, 1);
+  assert(get_inode_id(ino, id) == 1);
+
+  forget_inode(ino, 1);
+  assert(get_inode_id(ino, id) == 0);
+
+  // the root is never forgotten
+  forget_inode(1, 100);
+  assert(get_inode_id(1, id) == 1);
+
+  // a freed inode number is reused with a new generation
+  uuid_t other_id;
+  uuid_generate(other_id);
+
+  assert(add_inode_lookup(other_id) == ino);
+  assert(inode_table.inodes[ino - 1].generation != generation);
+  forget_inode(ino, 1);
+
+  // the table grows and inode numbers do not change
+  uuid_t ids[NUM_FILES];
+  unsigned long inos[NUM_FILES];
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    uuid_generate(ids[i]);
+    inos[i] = add_inode_lookup(ids[i]);
+  }
+
+  assert(inode_table.capacity > NUM_FILES);
+
+  for (int i = 0; i < NUM_FILES; i++) {
+    assert(get_inode_id(inos[i], id) == 1);
+    assert(uuid_compare(id, ids[i]) == 0);
+    assert(add_inode_lookup(ids[i]) == inos[i]);
+  }
+
+  clean_inode_table();
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
@@ -0,0 +1,62 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+#define NUM_KEYS 300
+#define NUM_WRITES 3000
+#define MAX_SIZE 40000
+
+// deterministic pseudo-random numbers, so that the test always does the same writes
+static unsigned int state;
+
+static unsigned int next_random() {
+  state = state * 1103515245 + 12345;
+  return (state >> 16) & 0x7fff;
+}
+
+static char records[NUM_KEYS][MAX_SIZE];
+static int sizes[NUM_KEYS];
+
+int main() {
+  int rc = unqlite_open(&pDb, "pager.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  char* check = malloc(MAX_SIZE);
+
+  // records of mixed sizes are overwritten many times in one transaction, so
+  // the pager flushes hot dirty pages while an overwrite still holds some of them
+  for (int round = 1; round <= 3; round++) {
+    state = round;
+
+    for (int i = 0; i < NUM_WRITES; i++) {
+      int key = next_random() % NUM_KEYS;
+      int size = (next_random() % 4 == 0) ? next_random() * MAX_SIZE / 32768 + 1 : next_random() % 200 + 1;
+
+      for (int j = 0; j < size; j++) {
+        records[key][j] = next_random();
+      }
+
+      sizes[key] = size;
+
+      rc = unqlite_kv_store(pDb, &key, sizeof(key), records[key], size);
+      if (rc != UNQLITE_OK) error_handler(rc);
+    }
+
+    // every record has the data of its last write
+    for (int key = 0; key < NUM_KEYS; key++) {
+      if (sizes[key] == 0) continue;
+
+      unqlite_int64 size = MAX_SIZE;
+      rc = unqlite_kv_fetch(pDb, &key, sizeof(key), check, &size);
+      if (rc != UNQLITE_OK) error_handler(rc);
+
+      assert(size == sizes[key]);
+      assert(memcmp(check, records[key], size) == 0);
+    }
+  }
+
+  free(check);
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
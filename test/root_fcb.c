@@ -0,0 +1,42 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+int main() {
+  int rc = unqlite_open(&pDb, "root_fcb.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb root;
+  create_directory(S_IRWXU, user, &root);
+  root.nlink = 1;
+  update_file(&root);
+
+  uuid_copy(root_object.id, root.id);
+  pin_root_fcb();
+
+  // the root is written through to the pinned copy
+  root.mode = S_IFDIR|S_IRUSR|S_IXUSR;
+  update_file(&root);
+
+  // and it is read from the pinned copy, not the database
+  delete_db_object(root.id);
+
+  struct my_fcb check_fcb;
+  assert(read_file(&(root.id), &check_fcb) == 0);
+  assert(check_fcb.mode == (S_IFDIR|S_IRUSR|S_IXUSR));
+
+  struct my_fcb file_fcb;
+  assert(find_file("/", user, &file_fcb) == MYFS_FIND_FOUND);
+  assert(uuid_compare(file_fcb.id, root.id) == 0);
+
+  // other files are still read from the database
+  struct my_fcb file;
+  create_file(0, user, &file);
+  delete_db_object(file.id);
+  assert(read_file(&(file.id), &check_fcb) == -1);
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
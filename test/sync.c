@@ -0,0 +1,106 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+int main() {
+  int rc = unqlite_open(&pDb, "sync.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  unqlite_config(pDb, UNQLITE_CONFIG_DISABLE_AUTO_COMMIT);
+  init_group_commit(100, 0);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb root_fcb;
+  create_directory(0, user, &root_fcb);
+  init_inode_table(root_fcb.id);
+
+  struct my_fcb file_fcb;
+  begin_db_operation();
+  create_file(0, user, &file_fcb);
+  link_file(&root_fcb, &file_fcb, "file");
+  end_db_operation();
+
+  // the creation is not committed yet, so the new inode is not in sync
+  unsigned long ino = add_inode_lookup(file_fcb.id);
+  assert(!is_file_data_synced(file_fcb.id));
+
+  sync_db();
+  assert(group_commit.commits == 1);
+  assert(is_file_data_synced(file_fcb.id));
+
+  char data[1000];
+  memset(data, 1, sizeof(data));
+
+  begin_db_operation();
+  write_file_data(&file_fcb, data, sizeof(data), 0);
+  mark_file_data_changed(file_fcb.id);
+  end_db_operation();
+
+  assert(!is_file_data_synced(file_fcb.id));
+
+  // sync commits the finished operation
+  sync_db();
+  assert(group_commit.commits == 2);
+  assert(group_commit.pending == 0);
+  assert(is_file_data_synced(file_fcb.id));
+
+  // nothing is pending, so no commit is made
+  sync_db();
+  assert(group_commit.commits == 2);
+
+  // FCB-only changes do not affect the data sync state
+  begin_db_operation();
+  file_fcb.mode |= S_IRUSR;
+  update_file(&file_fcb);
+  end_db_operation();
+
+  assert(is_file_data_synced(file_fcb.id));
+  assert(group_commit.pending == 1);
+
+  sync_db();
+  assert(group_commit.commits == 3);
+
+  // the sync state belongs to the file, not to the handle which wrote it,
+  // a file written and closed is not in sync when it is opened again
+  int fh = add_open_file(&file_fcb);
+  assert(fh >= 0);
+
+  begin_db_operation();
+  write_file_data(&file_fcb, data, sizeof(data), 0);
+  mark_file_data_changed(file_fcb.id);
+  end_db_operation();
+
+  remove_open_file(fh);
+  fh = add_open_file(&file_fcb);
+  assert(!is_file_data_synced(file_fcb.id));
+
+  // even if the kernel forgot the inode in between
+  forget_inode(ino, 1);
+  add_inode_lookup(file_fcb.id);
+  assert(!is_file_data_synced(file_fcb.id));
+
+  sync_db();
+  assert(group_commit.commits == 4);
+  assert(is_file_data_synced(file_fcb.id));
+
+  remove_open_file(fh);
+
+  // the synced data survives closing the database
+  unqlite_close(pDb);
+
+  rc = unqlite_open(&pDb, "sync.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_fcb check_fcb;
+  assert(read_file(&(file_fcb.id), &check_fcb) == 0);
+  assert(check_fcb.size == sizeof(data));
+  assert(check_fcb.mode & S_IRUSR);
+
+  char check[1000];
+  read_file_data(&check_fcb, check, sizeof(check), 0);
+  assert(memcmp(data, check, sizeof(data)) == 0);
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
@@ -0,0 +1,111 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+#define NUM_THREADS 8
+#define NUM_ROUNDS 200
+#define FILE_SIZE (3 * MY_BLOCK_SIZE)
+
+struct my_user user = {1, 1};
+
+struct my_fcb files[NUM_THREADS];
+
+// each thread looks up and reads its own file and writes to a shared file
+void* run_thread(void* arg) {
+  int n = *((int*) arg);
+
+  char path[32];
+  sprintf(path, "/dir%d/file", n);
+
+  char* data = malloc(FILE_SIZE);
+
+  for (int i = 0; i < NUM_ROUNDS; i++) {
+    struct my_fcb file_fcb;
+    assert(find_file(path, user, &file_fcb) == MYFS_FIND_FOUND);
+    assert(uuid_compare(file_fcb.id, files[n].id) == 0);
+
+    lock_fcb(file_fcb.id, 0);
+    read_file_data(&file_fcb, data, FILE_SIZE, 0);
+    unlock_fcb(file_fcb.id);
+
+    for (int j = 0; j < FILE_SIZE; j++) {
+      assert(data[j] == (char) n);
+    }
+
+    struct my_fcb shared_fcb;
+    assert(find_file("/shared", user, &shared_fcb) == MYFS_FIND_FOUND);
+
+    lock_fcb(shared_fcb.id, 1);
+    read_file(&(shared_fcb.id), &shared_fcb);
+    write_file_data(&shared_fcb, data, 100, n * 100);
+    unlock_fcb(shared_fcb.id);
+  }
+
+  free(data);
+  return NULL;
+}
+
+int main() {
+  int rc = unqlite_open(&pDb, "threads.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  init_block_cache(4);
+  init_fcb_cache(4);
+  init_dentry_cache(4);
+
+  struct my_fcb root_dir;
+  create_directory(S_IXUSR, user, &root_dir);
+  uuid_copy(root_object.id, root_dir.id);
+
+  struct my_fcb shared_fcb;
+  create_file(0, user, &shared_fcb);
+  add_dir_entry(&root_dir, &shared_fcb, "shared");
+
+  char* data = malloc(FILE_SIZE);
+
+  for (int n = 0; n < NUM_THREADS; n++) {
+    char name[16];
+    sprintf(name, "dir%d", n);
+
+    struct my_fcb dir_fcb;
+    create_directory(S_IXUSR, user, &dir_fcb);
+    add_dir_entry(&root_dir, &dir_fcb, name);
+
+    create_file(0, user, &files[n]);
+    add_dir_entry(&dir_fcb, &files[n], "file");
+
+    memset(data, n, FILE_SIZE);
+    write_file_data(&files[n], data, FILE_SIZE, 0);
+  }
+
+  // the caches are smaller than the number of threads, so they are evicting
+  // entries used by other threads all the time
+  pthread_t threads[NUM_THREADS];
+  int numbers[NUM_THREADS];
+
+  for (int n = 0; n < NUM_THREADS; n++) {
+    numbers[n] = n;
+    assert(pthread_create(&threads[n], NULL, run_thread, &numbers[n]) == 0);
+  }
+
+  for (int n = 0; n < NUM_THREADS; n++) {
+    pthread_join(threads[n], NULL);
+  }
+
+  // every thread wrote its own range of the shared file
+  read_file(&(shared_fcb.id), &shared_fcb);
+  assert(shared_fcb.size == NUM_THREADS * 100);
+
+  read_file_data(&shared_fcb, data, NUM_THREADS * 100, 0);
+
+  for (int n = 0; n < NUM_THREADS; n++) {
+    for (int j = 0; j < 100; j++) {
+      assert(data[n * 100 + j] == (char) n);
+    }
+  }
+
+  free(data);
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
@@ -1,6 +1,26 @@
 #include <assert.h>
 #include "../myfs_lib.h"
 
+/** Checks that the stored block map covers exactly the blocks of the file size */
+static void check_block_map(struct my_fcb* file_fcb) {
+  int num_blocks = get_num_blocks(file_fcb->size);
+
+  struct my_extent_map map;
+  open_extents(file_fcb, &map);
+
+  uuid_t block_id;
+  for (int block = 0; block < num_blocks + 2; block++) {
+    get_block_id(&map, block, block_id);
+    assert(uuid_is_null(block_id) == (block >= num_blocks));
+  }
+
+  close_extents(&map);
+
+  // the FCB record only holds the extents which are used
+  struct my_fcb stored_fcb;
+  assert(fetch_db_object(file_fcb->id, &stored_fcb, sizeof(stored_fcb)) == (long) get_fcb_record_size(file_fcb));
+}
+
 int main() {
   int rc = unqlite_open(&pDb, "truncate.db", UNQLITE_OPEN_CREATE);
   if (rc != UNQLITE_OK) error_handler(rc);
@@ -24,6 +44,52 @@ int main() {
   void* empty_blob = calloc(1, check_fcb.size);
   assert(memcmp(check_data, empty_blob, check_fcb.size) == 0);
 
+  // growing a file past the inline data size leaves holes, no data blocks
+  // are created
+  truncate_file(&file_fcb, 0);
+  truncate_file(&file_fcb, 2 * MY_BLOCK_SIZE);
+  assert(file_fcb.num_extents == 0);
+
+  // data cut off by shrinking the file is not visible after growing it again
+  void* block_data = malloc(MY_BLOCK_SIZE);
+  memset(block_data, 1, MY_BLOCK_SIZE);
+  write_file_data(&file_fcb, block_data, MY_BLOCK_SIZE, 0);
+  assert(file_fcb.num_extents == 1);
+
+  truncate_file(&file_fcb, MY_BLOCK_SIZE - 500);
+  truncate_file(&file_fcb, MY_BLOCK_SIZE);
+
+  void* empty_block = calloc(1, MY_BLOCK_SIZE);
+  read_file_data(&file_fcb, block_data, MY_BLOCK_SIZE, 0);
+  assert(memcmp(block_data + MY_BLOCK_SIZE - 500, empty_block, 500) == 0);
+
+  // the block map follows the number of blocks as the file grows and shrinks
+  struct my_fcb map_fcb;
+  create_file(0, user, &map_fcb);
+
+  void* map_data = malloc(8 * MY_BLOCK_SIZE);
+  memset(map_data, 2, 8 * MY_BLOCK_SIZE);
+
+  write_file_data(&map_fcb, map_data, 3 * MY_BLOCK_SIZE, 0);
+  check_block_map(&map_fcb);
+
+  write_file_data(&map_fcb, map_data, 8 * MY_BLOCK_SIZE, 0);
+  check_block_map(&map_fcb);
+
+  truncate_file(&map_fcb, 5 * MY_BLOCK_SIZE + 100);
+  check_block_map(&map_fcb);
+
+  truncate_file(&map_fcb, 2 * MY_BLOCK_SIZE);
+  check_block_map(&map_fcb);
+
+  write_file_data(&map_fcb, map_data, 6 * MY_BLOCK_SIZE, 0);
+  check_block_map(&map_fcb);
+
+  truncate_file(&map_fcb, 0);
+  check_block_map(&map_fcb);
+
+  free(map_data);
+
   puts("Test passed");
 
   unqlite_close(pDb);
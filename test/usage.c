@@ -0,0 +1,102 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+int main() {
+  int rc = unqlite_open(&pDb, "usage.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  unqlite_config(pDb, UNQLITE_CONFIG_DISABLE_AUTO_COMMIT);
+  init_group_commit(100, 0);
+
+  struct my_user user = {1, 1};
+
+  // creating files and directories counts them
+  struct my_fcb file_fcb;
+  create_file(0, user, &file_fcb);
+
+  struct my_fcb dir_fcb;
+  create_directory(0, user, &dir_fcb);
+
+  assert(root_object.files == 2);
+  assert(root_object.blocks == 0);
+
+  // small files are stored in the FCB and use no blocks
+  char* data = calloc(3, MY_BLOCK_SIZE);
+  write_file_data(&file_fcb, data, 100, 0);
+  assert(root_object.blocks == 0);
+
+  // data blocks are counted as they are allocated
+  write_file_data(&file_fcb, data, 3 * MY_BLOCK_SIZE, 0);
+  assert(root_object.blocks == 3);
+
+  // holes use no blocks
+  truncate_file(&file_fcb, 10 * MY_BLOCK_SIZE);
+  assert(root_object.blocks == 3);
+
+  truncate_file(&file_fcb, MY_BLOCK_SIZE + 1);
+  assert(root_object.blocks == 2);
+
+  truncate_file(&file_fcb, 100);
+  assert(root_object.blocks == 0);
+
+  write_file_data(&file_fcb, data, 2 * MY_BLOCK_SIZE, 0);
+  assert(root_object.blocks == 2);
+
+  // the statistics are taken from the counters
+  struct statvfs stbuf;
+  get_usage_stat(&stbuf);
+  assert(stbuf.f_bsize == MY_BLOCK_SIZE);
+  assert(stbuf.f_blocks - stbuf.f_bfree == 2);
+  assert(stbuf.f_files - stbuf.f_ffree == 2);
+
+  // the counters are stored in the root object with the commit
+  commit_db();
+  unqlite_close(pDb);
+
+  root_object.files = 0;
+  root_object.blocks = 0;
+
+  rc = unqlite_open(&pDb, "usage.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  assert(read_root() == UNQLITE_OK);
+  assert(root_object.files == 2);
+  assert(root_object.blocks == 2);
+
+  // removing a file releases its blocks
+  remove_file(&file_fcb);
+  assert(root_object.files == 1);
+  assert(root_object.blocks == 0);
+
+  remove_file(&dir_fcb);
+  assert(root_object.files == 0);
+
+  // a root object from before the counters existed only has the root UUID
+  uuid_t root_id;
+  uuid_generate(root_id);
+  uuid_copy(root_object.id, root_id);
+
+  rc = unqlite_kv_store(pDb, ROOT_OBJECT_KEY, ROOT_OBJECT_KEY_SIZE, &root_object, sizeof(uuid_t));
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  assert(read_root() == UNQLITE_OK);
+  assert(uuid_compare(root_object.id, root_id) == 0);
+  assert(root_object.files == 0);
+  assert(root_object.blocks == 0);
+
+  // the counters start from zero and the whole root object is stored again
+  create_file(0, user, &file_fcb);
+  write_file_data(&file_fcb, data, MY_BLOCK_SIZE, 0);
+  commit_db();
+
+  assert(read_root() == UNQLITE_OK);
+  assert(uuid_compare(root_object.id, root_id) == 0);
+  assert(root_object.files == 1);
+  assert(root_object.blocks == 1);
+
+  free(data);
+
+  puts("Test passed");
+
+  unqlite_close(pDb);
+}
@@ -0,0 +1,62 @@
+#include <assert.h>
+#include "../myfs_lib.h"
+
+int main() {
+  int rc = unqlite_open(&pDb, "write_buffer.db", UNQLITE_OPEN_CREATE);
+  if (rc != UNQLITE_OK) error_handler(rc);
+
+  struct my_user user = {1, 1};
+
+  struct my_fcb file_fcb;
+  create_file(S_IRUSR|S_IWUSR, user, &file_fcb);
+
+  int fh1 = add_open_file(&file_fcb);
+  int fh2 = add_open_file(&file_fcb);
+
+  char data[MY_BLOCK_SIZE];
+  for (int i = 0; i < MY_BLOCK_SIZE; i++) data[i] = i % 251;
+
+  struct my_fcb check_fcb;
+
+  // consecutive small writes are buffered
+  assert(buffer_file_write(fh1, data, 1000, 0));
+  assert(buffer_file_write(fh1, data + 1000, 1000, 1000));
+  get_open_file(fh1, &check_fcb);
+  assert(check_fcb.size == 0);
+
+  // flushing stores them in the file
+  assert(flush_file_buffers(file_fcb.id) == 1);
+  get_open_file(fh1, &check_fcb);
+  assert(check_fcb.size == 2000);
+
+  // completing the block writes the buffer
+  assert(buffer_file_write(fh1, data + 2000, MY_BLOCK_SIZE - 2000, 2000));
+  get_open_file(fh1, &check_fcb);
+  assert(check_fcb.size == MY_BLOCK_SIZE);
+
+  // writes through another handle flush the buffer first
+  assert(buffer_file_write(fh1, data, 100, MY_BLOCK_SIZE));
+  assert(buffer_file_write(fh2, data + 500, 10, MY_BLOCK_SIZE + 50));
+  get_open_file(fh1, &check_fcb);
+  assert(check_fcb.size == MY_BLOCK_SIZE + 100);
+
+  // closing the handle writes the buffer
+  assert(remove_open_file(fh2) == 0);
+  get_open_file(fh1, &check_fcb);
+
+  char check[MY_BLOCK_SIZE];
+  read_file_data(&check_fcb, check, MY_BLOCK_SIZE, 0);
+  assert(memcmp(check, data, MY_BLOCK_SIZE) == 0);
+  read_file_data(&check_fcb, check, 100, MY_BLOCK_SIZE);
+  assert(memcmp(check, data, 50) == 0);
+  assert(memcmp(check + 50, data + 500, 10) == 0);
+
+  // writes spanning blocks are not buffered
+  assert(!buffer_file_write(fh1, data, 200, MY_BLOCK_SIZE - 100));
+
+  assert(remove_open_file(fh1) == 0);
+
+  puts("Test passed");
+
+  return 0;
+}
@@ -57055,6 +57055,15 @@ static int pager_write_hot_dirty_pages(Pager *pPager,Page *pDirty)
 		}
 		/* Point to the next page */
 		pNext = pDirty->pPrevHot; /* Not a bug: Reverse link */
+		if( pDirty->nRef > 0 ){
+			/* The page was referenced again after it became hot and may still be
+			 * changed by its user, keep it dirty. It is added to the hot dirty
+			 * list again once it is unreferenced.
+			 */
+			pDirty->flags &= ~PAGE_HOT_DIRTY;
+			pDirty = pNext;
+			continue;
+		}
 		if( (pDirty->flags & PAGE_DONT_WRITE) == 0 ){
 			rc = unqliteOsWrite(pPager->pfd,pDirty->zData,pPager->iPageSize,pDirty->pgno * pPager->iPageSize);
 			if( rc != UNQLITE_OK ){